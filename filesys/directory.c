@@ -1,10 +1,13 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include <round.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir {
@@ -12,17 +15,165 @@ struct dir {
 	off_t pos;                          /* Current position. */
 };
 
-/* A single directory entry. */
+/* A single directory entry.  An entry that was never used is all
+ * zeros; a removed one keeps its INODE_SECTOR, which is never 0. */
 struct dir_entry {
 	disk_sector_t inode_sector;         /* Sector number of header. */
 	char name[NAME_MAX + 1];            /* Null terminated file name. */
 	bool in_use;                        /* In use or free? */
 };
 
+/* Directory format.
+ *
+ * A directory of up to ENTRIES_PER_SECTOR entries is a plain
+ * array of them, searched linearly.  A larger one is a hash table
+ * of a power of 2 of buckets, each a sector holding
+ * ENTRIES_PER_SECTOR entries.  A name goes into the first bucket
+ * with a free entry among the PROBE_MAX buckets from the one its
+ * hash picks, so that finding or adding it reads at most PROBE_MAX
+ * sectors.  If they are all full, the table is rebuilt with twice
+ * as many buckets.  Which format a directory has follows from its
+ * length, as a linear directory never exceeds a sector. */
+#define ENTRIES_PER_SECTOR (DISK_SECTOR_SIZE / sizeof (struct dir_entry))
+#define LINEAR_MAX (ENTRIES_PER_SECTOR * sizeof (struct dir_entry))
+#define MIN_BUCKETS 4                   /* Buckets of a new hash table. */
+#define MAX_BUCKETS 2048                /* Largest hash table. */
+#define PROBE_MAX 4                     /* Buckets searched for a name. */
+
+/* Directory entry cache.
+ *
+ * Remembers which inode sector a name in a directory resolved to,
+ * or that it resolved to none, so that looking the same names up
+ * again reads no directory sectors.  Entries are keyed by the
+ * directory's inode sector and the name, and the least recently
+ * used one is replaced.  dir_add() and dir_remove() update the
+ * entries of the names they change.  One lock protects the cache,
+ * including the directory search done on a miss. */
+#define DCACHE_CNT 128
+
+struct dentry {
+	struct hash_elem elem;              /* In DCACHE_MAP, if valid. */
+	struct list_elem lru_elem;          /* In DCACHE_LRU. */
+	bool valid;                         /* Holds a name. */
+	disk_sector_t parent;               /* Directory's inode sector. */
+	char name[NAME_MAX + 1];            /* Null terminated file name. */
+	disk_sector_t inode_sector;         /* NAME's inode, 0 if none. */
+};
+
+static struct dentry dentries[DCACHE_CNT];
+static struct hash dcache_map;
+static struct list dcache_lru;          /* Most recently used first. */
+static struct lock dcache_lock;
+
+static uint64_t
+dentry_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct dentry *d = hash_entry (e, struct dentry, elem);
+	return hash_string (d->name) ^ hash_int (d->parent);
+}
+
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct dentry *a = hash_entry (a_, struct dentry, elem);
+	const struct dentry *b = hash_entry (b_, struct dentry, elem);
+
+	if (a->parent != b->parent)
+		return a->parent < b->parent;
+	return strcmp (a->name, b->name) < 0;
+}
+
+/* Initializes the directory module. */
+void
+dir_init (void) {
+	size_t i;
+
+	if (!hash_init (&dcache_map, dentry_hash, dentry_less, NULL))
+		PANIC ("dir_init() out of memory");
+	list_init (&dcache_lru);
+	lock_init (&dcache_lock);
+	for (i = 0; i < DCACHE_CNT; i++)
+		list_push_back (&dcache_lru, &dentries[i].lru_elem);
+}
+
+/* Returns the cache entry for NAME in the directory whose inode is
+ * in PARENT and marks it used, or a null pointer.  DCACHE_LOCK
+ * must be held. */
+static struct dentry *
+dcache_find (disk_sector_t parent, const char *name) {
+	struct dentry key;
+	struct hash_elem *e;
+	struct dentry *d;
+
+	key.parent = parent;
+	strlcpy (key.name, name, sizeof key.name);
+	e = hash_find (&dcache_map, &key.elem);
+	if (e == NULL)
+		return NULL;
+
+	d = hash_entry (e, struct dentry, elem);
+	list_remove (&d->lru_elem);
+	list_push_front (&dcache_lru, &d->lru_elem);
+	return d;
+}
+
+/* Records that NAME in the directory whose inode is in PARENT is
+ * the inode in INODE_SECTOR, or no file if it is 0, replacing the
+ * least recently used entry if NAME has none.  DCACHE_LOCK must
+ * be held. */
+static void
+dcache_set (disk_sector_t parent, const char *name,
+		disk_sector_t inode_sector) {
+	struct dentry *d = dcache_find (parent, name);
+
+	if (d == NULL) {
+		d = list_entry (list_back (&dcache_lru), struct dentry, lru_elem);
+		if (d->valid)
+			hash_delete (&dcache_map, &d->elem);
+		d->valid = true;
+		d->parent = parent;
+		strlcpy (d->name, name, sizeof d->name);
+		hash_insert (&dcache_map, &d->elem);
+		list_remove (&d->lru_elem);
+		list_push_front (&dcache_lru, &d->lru_elem);
+	}
+	d->inode_sector = inode_sector;
+}
+
+/* Drops the entries of the directory whose inode is in PARENT,
+ * whose sector may be reused.  DCACHE_LOCK must be held. */
+static void
+dcache_purge (disk_sector_t parent) {
+	size_t i;
+
+	for (i = 0; i < DCACHE_CNT; i++) {
+		struct dentry *d = &dentries[i];
+
+		if (d->valid && d->parent == parent) {
+			hash_delete (&dcache_map, &d->elem);
+			d->valid = false;
+			list_remove (&d->lru_elem);
+			list_push_back (&dcache_lru, &d->lru_elem);
+		}
+	}
+}
+
+/* Returns the number of buckets of a hash table for ENTRY_CNT
+ * entries, at most half full. */
+static size_t
+buckets_for (size_t entry_cnt) {
+	size_t cnt = MIN_BUCKETS;
+
+	while (cnt * ENTRIES_PER_SECTOR < entry_cnt * 2)
+		cnt *= 2;
+	return cnt;
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
  * given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (disk_sector_t sector, size_t entry_cnt) {
+	if (entry_cnt > ENTRIES_PER_SECTOR)
+		return inode_create (sector, buckets_for (entry_cnt) * DISK_SECTOR_SIZE);
 	return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
 }
 
@@ -71,6 +222,80 @@ dir_get_inode (struct dir *dir) {
 	return dir->inode;
 }
 
+/* Returns the number of buckets of DIR, 1 if it is linear. */
+static size_t
+bucket_cnt (const struct dir *dir) {
+	off_t length = inode_length (dir->inode);
+
+	return length > (off_t) LINEAR_MAX ? length / DISK_SECTOR_SIZE : 1;
+}
+
+/* Returns the bucket NAME hashes to in a table of CNT buckets. */
+static size_t
+home_bucket (const char *name, size_t cnt) {
+	return hash_string (name) & (cnt - 1);
+}
+
+/* Returns the byte offset of the entry after the one at OFS,
+ * skipping the unused tail of a bucket. */
+static off_t
+next_ofs (off_t ofs) {
+	ofs += sizeof (struct dir_entry);
+	if (ofs % DISK_SECTOR_SIZE + sizeof (struct dir_entry) > DISK_SECTOR_SIZE)
+		ofs = ROUND_UP (ofs, DISK_SECTOR_SIZE);
+	return ofs;
+}
+
+/* Reads the entries of bucket B of DIR, all of them if DIR is
+ * linear, into ENTRIES and returns how many there are. */
+static size_t
+read_bucket (const struct dir *dir, size_t b,
+		struct dir_entry entries[ENTRIES_PER_SECTOR]) {
+	return inode_read_at (dir->inode, entries, LINEAR_MAX,
+			b * DISK_SECTOR_SIZE) / sizeof *entries;
+}
+
+/* Searches the buckets of DIR where NAME may be.
+ * If FOR_ADD is false, looks for the entry of NAME; otherwise
+ * looks for a free entry that NAME can take.  If successful,
+ * returns true, sets *EP to the directory entry if EP is
+ * non-null, and sets *OFSP to the byte offset of the directory
+ * entry if OFSP is non-null.  Otherwise, returns false and
+ * ignores EP and OFSP. */
+static bool
+search (const struct dir *dir, const char *name, bool for_add,
+		struct dir_entry *ep, off_t *ofsp) {
+	struct dir_entry entries[ENTRIES_PER_SECTOR];
+	size_t cnt = bucket_cnt (dir);
+	size_t b = home_bucket (name, cnt);
+	size_t probe, i, n;
+
+	for (probe = 0; probe < PROBE_MAX && probe < cnt; probe++) {
+		bool never_used = false;
+
+		n = read_bucket (dir, b, entries);
+		for (i = 0; i < n; i++) {
+			struct dir_entry *e = &entries[i];
+
+			if (for_add ? !e->in_use : e->in_use && !strcmp (name, e->name)) {
+				if (ep != NULL)
+					*ep = *e;
+				if (ofsp != NULL)
+					*ofsp = b * DISK_SECTOR_SIZE + i * sizeof *e;
+				return true;
+			}
+			if (!e->in_use && e->inode_sector == 0)
+				never_used = true;
+		}
+
+		/* NAME was never put past a bucket with room to spare. */
+		if (never_used)
+			break;
+		b = (b + 1) & (cnt - 1);
+	}
+	return false;
+}
+
 /* Searches DIR for a file with the given NAME.
  * If successful, returns true, sets *EP to the directory entry
  * if EP is non-null, and sets *OFSP to the byte offset of the
@@ -79,21 +304,105 @@ dir_get_inode (struct dir *dir) {
 static bool
 lookup (const struct dir *dir, const char *name,
 		struct dir_entry *ep, off_t *ofsp) {
-	struct dir_entry e;
-	size_t ofs;
-
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
-	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-			ofs += sizeof e)
-		if (e.in_use && !strcmp (name, e.name)) {
-			if (ep != NULL)
-				*ep = e;
-			if (ofsp != NULL)
-				*ofsp = ofs;
-			return true;
+	return search (dir, name, false, ep, ofsp);
+}
+
+/* Like lookup(), but only finds the inode sector of NAME, which
+ * it stores into *SECTORP, and goes through the dentry cache. */
+static bool
+cached_lookup (const struct dir *dir, const char *name,
+		disk_sector_t *sectorp) {
+	disk_sector_t parent = inode_get_inumber (dir->inode);
+	struct dir_entry e;
+	struct dentry *d;
+	bool found;
+
+	/* Such a name could not be cached without truncating it. */
+	if (strlen (name) > NAME_MAX)
+		return false;
+
+	lock_acquire (&dcache_lock);
+	d = dcache_find (parent, name);
+	if (d != NULL)
+		e.inode_sector = d->inode_sector;
+	else {
+		if (!lookup (dir, name, &e, NULL))
+			e.inode_sector = 0;
+		dcache_set (parent, name, e.inode_sector);
+	}
+	lock_release (&dcache_lock);
+
+	found = e.inode_sector != 0;
+	if (found)
+		*sectorp = e.inode_sector;
+	return found;
+}
+
+/* Puts E into the first free entry of the PROBE_MAX buckets from
+ * its home bucket in TABLE, a hash table of CNT buckets in memory.
+ * Returns false if they are all full. */
+static bool
+table_insert (uint8_t *table, size_t cnt, const struct dir_entry *e) {
+	size_t b = home_bucket (e->name, cnt);
+	size_t probe, i;
+
+	for (probe = 0; probe < PROBE_MAX && probe < cnt; probe++) {
+		struct dir_entry *entries =
+			(struct dir_entry *) (table + b * DISK_SECTOR_SIZE);
+
+		for (i = 0; i < ENTRIES_PER_SECTOR; i++)
+			if (!entries[i].in_use) {
+				entries[i] = *e;
+				return true;
+			}
+		b = (b + 1) & (cnt - 1);
+	}
+	return false;
+}
+
+/* Rebuilds DIR as a hash table with at least twice as many
+ * buckets, MIN_BUCKETS if it was linear, and no removed entries.
+ * Returns true if successful, false if memory or disk allocation
+ * fails or DIR would grow past MAX_BUCKETS.  DIR is left as it was
+ * on failure. */
+static bool
+dir_grow (struct dir *dir) {
+	struct dir_entry entries[ENTRIES_PER_SECTOR];
+	size_t old_cnt = bucket_cnt (dir);
+	size_t cnt = inode_length (dir->inode) > (off_t) LINEAR_MAX
+		? old_cnt * 2 : MIN_BUCKETS;
+
+	for (; cnt <= MAX_BUCKETS; cnt *= 2) {
+		off_t size = cnt * DISK_SECTOR_SIZE;
+		uint8_t *table = calloc (1, size);
+		bool fits = true;
+		size_t b, i, n;
+
+		if (table == NULL)
+			return false;
+		for (b = 0; fits && b < old_cnt; b++) {
+			n = read_bucket (dir, b, entries);
+			for (i = 0; fits && i < n; i++)
+				if (entries[i].in_use)
+					fits = table_insert (table, cnt, &entries[i]);
 		}
+
+		/* Too many names crowd some buckets; spread them further. */
+		if (!fits) {
+			free (table);
+			continue;
+		}
+
+		/* The table overwrites the old entries.  Get all of its
+		 * sectors first, so that a full disk fails before that. */
+		fits = inode_allocate (dir->inode, size)
+			&& inode_write_at (dir->inode, table, size, 0) == size;
+		free (table);
+		return fits;
+	}
 	return false;
 }
 
@@ -104,13 +413,13 @@ lookup (const struct dir *dir, const char *name,
 bool
 dir_lookup (const struct dir *dir, const char *name,
 		struct inode **inode) {
-	struct dir_entry e;
+	disk_sector_t sector;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
-	if (lookup (dir, name, &e, NULL))
-		*inode = inode_open (e.inode_sector);
+	if (cached_lookup (dir, name, &sector))
+		*inode = inode_open (sector);
 	else
 		*inode = NULL;
 
@@ -126,6 +435,7 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
 	struct dir_entry e;
+	disk_sector_t sector;
 	off_t ofs;
 	bool success = false;
 
@@ -137,20 +447,20 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
 		return false;
 
 	/* Check that NAME is not in use. */
-	if (lookup (dir, name, NULL, NULL))
+	if (cached_lookup (dir, name, &sector))
 		goto done;
 
 	/* Set OFS to offset of free slot.
-	 * If there are no free slots, then it will be set to the
-	 * current end-of-file.
-
-	 * inode_read_at() will only return a short read at end of file.
-	 * Otherwise, we'd need to verify that we didn't get a short
-	 * read due to something intermittent such as low memory. */
-	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-			ofs += sizeof e)
-		if (!e.in_use)
+	 * If there are no free slots, a linear directory with room for
+	 * one more entry grows by one at its end; otherwise the
+	 * directory is rebuilt as a larger hash table. */
+	while (!search (dir, name, true, NULL, &ofs)) {
+		ofs = inode_length (dir->inode);
+		if (bucket_cnt (dir) == 1 && ofs + sizeof e <= LINEAR_MAX)
 			break;
+		if (!dir_grow (dir))
+			goto done;
+	}
 
 	/* Write slot. */
 	e.in_use = true;
@@ -158,6 +468,12 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
 	e.inode_sector = inode_sector;
 	success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 
+	if (success) {
+		lock_acquire (&dcache_lock);
+		dcache_set (inode_get_inumber (dir->inode), name, inode_sector);
+		lock_release (&dcache_lock);
+	}
+
 done:
 	return success;
 }
@@ -189,6 +505,12 @@ dir_remove (struct dir *dir, const char *name) {
 	if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
 		goto done;
 
+	/* Forget NAME, and the names in it if it is a directory. */
+	lock_acquire (&dcache_lock);
+	dcache_set (inode_get_inumber (dir->inode), name, 0);
+	dcache_purge (e.inode_sector);
+	lock_release (&dcache_lock);
+
 	/* Remove inode. */
 	inode_remove (inode);
 	success = true;
@@ -206,7 +528,7 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1]) {
 	struct dir_entry e;
 
 	while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) {
-		dir->pos += sizeof e;
+		dir->pos = next_ofs (dir->pos);
 		if (e.in_use) {
 			strlcpy (name, e.name, NAME_MAX + 1);
 			return true;
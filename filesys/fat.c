@@ -1,6 +1,7 @@
 #include "filesys/fat.h"
 #include "devices/disk.h"
 #include "filesys/filesys.h"
+#include "filesys/page_cache.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
 #include <stdio.h>
@@ -51,66 +52,39 @@ fat_init (void) {
 	fat_fs_init ();
 }
 
+/* Loads the FAT into memory.  After a format the table is
+ * already there.  It is read through the buffer cache, which
+ * fat_put() writes it back through. */
 void
 fat_open (void) {
+	const size_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
+	size_t ofs;
+
+	if (fat_fs->fat != NULL)
+		return;
+
 	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
 	if (fat_fs->fat == NULL)
 		PANIC ("FAT load failed");
 
-	// Load FAT directly from the disk
-	uint8_t *buffer = (uint8_t *) fat_fs->fat;
-	off_t bytes_read = 0;
-	off_t bytes_left = sizeof (fat_fs->fat);
-	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
-		bytes_left = fat_size_in_bytes - bytes_read;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_read (filesys_disk, fat_fs->bs.fat_start + i,
-			           buffer + bytes_read);
-			bytes_read += DISK_SECTOR_SIZE;
-		} else {
-			uint8_t *bounce = malloc (DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT load failed");
-			disk_read (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			memcpy (buffer + bytes_read, bounce, bytes_left);
-			bytes_read += bytes_left;
-			free (bounce);
-		}
+	for (ofs = 0; ofs < fat_size_in_bytes; ofs += DISK_SECTOR_SIZE) {
+		size_t chunk = fat_size_in_bytes - ofs < DISK_SECTOR_SIZE
+			? fat_size_in_bytes - ofs : DISK_SECTOR_SIZE;
+		page_cache_read (fat_fs->bs.fat_start + ofs / DISK_SECTOR_SIZE,
+				(uint8_t *) fat_fs->fat + ofs, 0, chunk);
 	}
 }
 
+/* Writes the boot sector.  The FAT itself is written back entry
+ * by entry as it changes, see fat_put(). */
 void
 fat_close (void) {
-	// Write FAT boot sector
 	uint8_t *bounce = calloc (1, DISK_SECTOR_SIZE);
 	if (bounce == NULL)
 		PANIC ("FAT close failed");
 	memcpy (bounce, &fat_fs->bs, sizeof (fat_fs->bs));
 	disk_write (filesys_disk, FAT_BOOT_SECTOR, bounce);
 	free (bounce);
-
-	// Write FAT directly to the disk
-	uint8_t *buffer = (uint8_t *) fat_fs->fat;
-	off_t bytes_wrote = 0;
-	off_t bytes_left = sizeof (fat_fs->fat);
-	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
-		bytes_left = fat_size_in_bytes - bytes_wrote;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i,
-			            buffer + bytes_wrote);
-			bytes_wrote += DISK_SECTOR_SIZE;
-		} else {
-			bounce = calloc (1, DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT close failed");
-			memcpy (bounce, buffer + bytes_wrote, bytes_left);
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			bytes_wrote += bytes_left;
-			free (bounce);
-		}
-	}
 }
 
 void
@@ -124,14 +98,20 @@ fat_create (void) {
 	if (fat_fs->fat == NULL)
 		PANIC ("FAT creation failed");
 
+	// Clear the FAT on disk
+	uint8_t *buf = calloc (1, DISK_SECTOR_SIZE);
+	if (buf == NULL)
+		PANIC ("FAT create failed due to OOM");
+	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++)
+		page_cache_write (fat_fs->bs.fat_start + i, buf, 0, DISK_SECTOR_SIZE);
+
 	// Set up ROOT_DIR_CLST
 	fat_put (ROOT_DIR_CLUSTER, EOChain);
 
 	// Fill up ROOT_DIR_CLUSTER region with 0
-	uint8_t *buf = calloc (1, DISK_SECTOR_SIZE);
-	if (buf == NULL)
-		PANIC ("FAT create failed due to OOM");
-	disk_write (filesys_disk, cluster_to_sector (ROOT_DIR_CLUSTER), buf);
+	for (unsigned i = 0; i < SECTORS_PER_CLUSTER; i++)
+		page_cache_write (cluster_to_sector (ROOT_DIR_CLUSTER) + i, buf, 0,
+				DISK_SECTOR_SIZE);
 	free (buf);
 }
 
@@ -152,7 +132,18 @@ fat_boot_create (void) {
 
 void
 fat_fs_init (void) {
-	/* TODO: Your code goes here. */
+	const unsigned entries = fat_fs->bs.fat_sectors
+		* (DISK_SECTOR_SIZE / sizeof (cluster_t));
+
+	/* Data clusters follow the FAT, numbered from 1.  Entry 0 of
+	 * the FAT is never used, as cluster 0 means "none". */
+	fat_fs->data_start = fat_fs->bs.fat_start + fat_fs->bs.fat_sectors;
+	fat_fs->fat_length = (fat_fs->bs.total_sectors - fat_fs->data_start)
+		/ SECTORS_PER_CLUSTER + 1;
+	if (fat_fs->fat_length > entries)
+		fat_fs->fat_length = entries;
+	fat_fs->last_clst = ROOT_DIR_CLUSTER;
+	lock_init (&fat_fs->write_lock);
 }
 
 /*----------------------------------------------------------------------------*/
@@ -161,33 +152,87 @@ fat_fs_init (void) {
 
 /* Add a cluster to the chain.
  * If CLST is 0, start a new chain.
- * Returns 0 if fails to allocate a new cluster. */
+ * Returns 0 if fails to allocate a new cluster.
+ *
+ * The search for a free cluster starts at LAST_CLST, just past the
+ * last one handed out or at the lowest one freed since, so that
+ * consecutive allocations need not rescan the used part of the
+ * table and tend to be adjacent on disk. */
 cluster_t
 fat_create_chain (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	cluster_t new_clst = 0;
+	cluster_t c;
+	unsigned i;
+
+	lock_acquire (&fat_fs->write_lock);
+	c = fat_fs->last_clst;
+	for (i = 1; i < fat_fs->fat_length; i++) {
+		if (c == 0 || c >= fat_fs->fat_length)
+			c = 1;
+		if (fat_fs->fat[c] == 0) {
+			new_clst = c;
+			break;
+		}
+		c++;
+	}
+
+	if (new_clst != 0) {
+		fat_put (new_clst, EOChain);
+		if (clst != 0)
+			fat_put (clst, new_clst);
+		fat_fs->last_clst = new_clst + 1;
+	}
+	lock_release (&fat_fs->write_lock);
+	return new_clst;
 }
 
 /* Remove the chain of clusters starting from CLST.
  * If PCLST is 0, assume CLST as the start of the chain. */
 void
 fat_remove_chain (cluster_t clst, cluster_t pclst) {
-	/* TODO: Your code goes here. */
+	lock_acquire (&fat_fs->write_lock);
+	if (pclst != 0)
+		fat_put (pclst, EOChain);
+	while (clst != 0 && clst != EOChain) {
+		cluster_t next = fat_get (clst);
+
+		fat_put (clst, 0);
+		if (clst < fat_fs->last_clst)
+			fat_fs->last_clst = clst;
+		clst = next;
+	}
+	lock_release (&fat_fs->write_lock);
 }
 
-/* Update a value in the FAT table. */
+/* Update a value in the FAT table.  Only the entry is written,
+ * into the FAT sector in the buffer cache that holds it. */
 void
 fat_put (cluster_t clst, cluster_t val) {
-	/* TODO: Your code goes here. */
+	const size_t per_sector = DISK_SECTOR_SIZE / sizeof (cluster_t);
+
+	ASSERT (clst != 0 && clst < fat_fs->fat_length);
+	fat_fs->fat[clst] = val;
+	page_cache_write (fat_fs->bs.fat_start + clst / per_sector, &val,
+			clst % per_sector * sizeof (cluster_t), sizeof (cluster_t));
 }
 
 /* Fetch a value in the FAT table. */
 cluster_t
 fat_get (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst != 0 && clst < fat_fs->fat_length);
+	return fat_fs->fat[clst];
 }
 
 /* Covert a cluster # to a sector number. */
 disk_sector_t
 cluster_to_sector (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst != 0);
+	return fat_fs->data_start + (clst - 1) * SECTORS_PER_CLUSTER;
+}
+
+/* Converts the first sector of a cluster back to its cluster #. */
+cluster_t
+sector_to_cluster (disk_sector_t sector) {
+	ASSERT (sector >= fat_fs->data_start);
+	return (sector - fat_fs->data_start) / SECTORS_PER_CLUSTER + 1;
 }
@@ -1,15 +1,53 @@
 #include "filesys/file.h"
 #include <debug.h>
 #include "filesys/inode.h"
+#include "devices/disk.h"
 #include "threads/malloc.h"
 
+/* Readahead window bounds, in bytes. */
+#define RA_MIN (4 * DISK_SECTOR_SIZE)
+#define RA_MAX (16 * DISK_SECTOR_SIZE)
+
 /* An open file. */
 struct file {
 	struct inode *inode;        /* File's inode. */
 	off_t pos;                  /* Current position. */
 	bool deny_write;            /* Has file_deny_write() been called? */
+
+	/* Sequential readahead, see file_readahead(). */
+	off_t ra_next;              /* Where a sequential read starts. */
+	off_t ra_window;            /* Bytes to keep read ahead, or 0. */
+	off_t ra_end;               /* End of what was read ahead. */
 };
 
+/* Notes a read of READ bytes of FILE at OFS.  Reads that start
+ * where the last one ended form a stream.  While it lasts, the
+ * window of bytes kept read ahead of it doubles from RA_MIN up to
+ * RA_MAX, and more is asked for whenever less than half of it
+ * remains.  Any other read ends the stream. */
+static void
+file_readahead (struct file *file, off_t ofs, off_t read) {
+	off_t end = ofs + read;
+
+	if (read <= 0)
+		return;
+
+	if (ofs != file->ra_next || file->ra_window == 0) {
+		/* A read from the start counts as the start of a stream. */
+		file->ra_window = ofs == file->ra_next ? RA_MIN : 0;
+		file->ra_end = end;
+	} else if (file->ra_window < RA_MAX)
+		file->ra_window *= 2;
+	file->ra_next = end;
+
+	if (file->ra_window > 0 && file->ra_end - end < file->ra_window / 2) {
+		off_t start = file->ra_end > end ? file->ra_end : end;
+
+		inode_readahead (file->inode, start, end + file->ra_window - start);
+		file->ra_end = end + file->ra_window;
+	}
+}
+
 /* Opens a file for the given INODE, of which it takes ownership,
  * and returns the new file.  Returns a null pointer if an
  * allocation fails or if INODE is null. */
@@ -72,6 +110,7 @@ file_get_inode (struct file *file) {
 off_t
 file_read (struct file *file, void *buffer, off_t size) {
 	off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+	file_readahead (file, file->pos, bytes_read);
 	file->pos += bytes_read;
 	return bytes_read;
 }
@@ -83,15 +122,16 @@ file_read (struct file *file, void *buffer, off_t size) {
  * The file's current position is unaffected. */
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) {
-	return inode_read_at (file->inode, buffer, size, file_ofs);
+	off_t bytes_read = inode_read_at (file->inode, buffer, size, file_ofs);
+	file_readahead (file, file_ofs, bytes_read);
+	return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
  * starting at the file's current position.
  * Returns the number of bytes actually written,
- * which may be less than SIZE if end of file is reached.
- * (Normally we'd grow the file in that case, but file growth is
- * not yet implemented.)
+ * which may be less than SIZE if the disk is full.
+ * Writing past end of file grows the file.
  * Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) {
@@ -103,9 +143,8 @@ file_write (struct file *file, const void *buffer, off_t size) {
 /* Writes SIZE bytes from BUFFER into FILE,
  * starting at offset FILE_OFS in the file.
  * Returns the number of bytes actually written,
- * which may be less than SIZE if end of file is reached.
- * (Normally we'd grow the file in that case, but file growth is
- * not yet implemented.)
+ * which may be less than SIZE if the disk is full.
+ * Writing past end of file grows the file.
  * The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
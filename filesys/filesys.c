@@ -6,6 +6,7 @@
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/page_cache.h"
 #include "devices/disk.h"
 
 /* The disk that contains the file system. */
@@ -21,7 +22,9 @@ filesys_init (bool format) {
 	if (filesys_disk == NULL)
 		PANIC ("hd0:1 (hdb) not present, file system initialization failed");
 
+	page_cache_init ();
 	inode_init ();
+	dir_init ();
 
 #ifdef EFILESYS
 	fat_init ();
@@ -51,6 +54,7 @@ filesys_done (void) {
 #else
 	free_map_close ();
 #endif
+	page_cache_flush ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -110,6 +114,8 @@ do_format (void) {
 #ifdef EFILESYS
 	/* Create FAT and save it to the disk. */
 	fat_create ();
+	if (!dir_create (ROOT_DIR_SECTOR, 16))
+		PANIC ("root directory creation failed");
 	fat_close ();
 #else
 	free_map_create ();
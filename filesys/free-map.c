@@ -4,10 +4,18 @@
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#ifdef EFILESYS
+#include "filesys/fat.h"
+#endif
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
 
+/* True if FREE_MAP has changed since it was last written.  The
+ * free map file is only brought up to date by free_map_close(),
+ * instead of on every allocation and release. */
+static bool free_map_dirty;
+
 /* Initializes the free map. */
 void
 free_map_init (void) {
@@ -24,24 +32,72 @@ free_map_init (void) {
  * available. */
 bool
 free_map_allocate (size_t cnt, disk_sector_t *sectorp) {
+#ifdef EFILESYS
+	/* With the FAT, inodes take a cluster of their own, a chain of
+	 * one.  File data is allocated by the inode as a chain. */
+	cluster_t clst;
+
+	ASSERT (cnt == 1);
+	clst = fat_create_chain (0);
+	if (clst != 0)
+		*sectorp = cluster_to_sector (clst);
+	return clst != 0;
+#else
 	disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-	if (sector != BITMAP_ERROR
-			&& free_map_file != NULL
-			&& !bitmap_write (free_map, free_map_file)) {
-		bitmap_set_multiple (free_map, sector, cnt, false);
-		sector = BITMAP_ERROR;
-	}
-	if (sector != BITMAP_ERROR)
+	if (sector != BITMAP_ERROR) {
+		free_map_dirty = true;
 		*sectorp = sector;
+	}
 	return sector != BITMAP_ERROR;
+#endif
+}
+
+/* Allocates a run of up to CNT consecutive sectors.  The run
+ * starts at GOAL if that sector is free, else it is the first run
+ * of all CNT sectors at or after GOAL, or before it, and failing
+ * that the first free sectors on disk.  Stores the first sector of
+ * the run into *SECTORP and returns its length, which is 0 if the
+ * disk is full. */
+size_t
+free_map_allocate_run (disk_sector_t goal, size_t cnt,
+		disk_sector_t *sectorp) {
+	size_t size = bitmap_size (free_map);
+	size_t start, n;
+
+	ASSERT (cnt > 0);
+
+	if (goal >= size)
+		goal = 0;
+	start = goal;
+	if (bitmap_test (free_map, start))
+		start = bitmap_scan (free_map, goal, cnt, false);
+	if (start == BITMAP_ERROR)
+		start = bitmap_scan (free_map, 0, cnt, false);
+	if (start == BITMAP_ERROR)
+		start = bitmap_scan (free_map, 0, 1, false);
+	if (start == BITMAP_ERROR)
+		return 0;
+
+	for (n = 0; n < cnt && start + n < size; n++)
+		if (bitmap_test (free_map, start + n))
+			break;
+	bitmap_set_multiple (free_map, start, n, true);
+	free_map_dirty = true;
+	*sectorp = start;
+	return n;
 }
 
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (disk_sector_t sector, size_t cnt) {
+#ifdef EFILESYS
+	ASSERT (cnt == 1);
+	fat_remove_chain (sector_to_cluster (sector), 0);
+#else
 	ASSERT (bitmap_all (free_map, sector, cnt));
 	bitmap_set_multiple (free_map, sector, cnt, false);
-	bitmap_write (free_map, free_map_file);
+	free_map_dirty = true;
+#endif
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -57,6 +113,9 @@ free_map_open (void) {
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) {
+	if (free_map_dirty && !bitmap_write (free_map, free_map_file))
+		PANIC ("can't write free map");
+	free_map_dirty = false;
 	file_close (free_map_file);
 }
 
@@ -74,4 +133,5 @@ free_map_create (void) {
 		PANIC ("can't open free map");
 	if (!bitmap_write (free_map, free_map_file))
 		PANIC ("can't write free map");
+	free_map_dirty = false;
 }
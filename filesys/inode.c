@@ -5,19 +5,72 @@
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/page_cache.h"
 #include "threads/malloc.h"
+#ifdef EFILESYS
+#include "filesys/fat.h"
+#endif
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+#ifdef EFILESYS
+/* Bytes in a cluster. */
+#define CLUSTER_SIZE (DISK_SECTOR_SIZE * SECTORS_PER_CLUSTER)
+
+/* Largest number of data sectors a file can have. */
+#define MAX_SECTORS ((size_t) INT32_MAX / DISK_SECTOR_SIZE)
+
 /* On-disk inode.
- * Must be exactly DISK_SECTOR_SIZE bytes long. */
+ * Must be exactly DISK_SECTOR_SIZE bytes long.
+ *
+ * The data is a chain of clusters in the FAT that starts at
+ * START, or 0 if the file has none yet. */
 struct inode_disk {
-	disk_sector_t start;                /* First data sector. */
+	cluster_t start;                    /* First data cluster. */
 	off_t length;                       /* File size in bytes. */
 	unsigned magic;                     /* Magic number. */
 	uint32_t unused[125];               /* Not used. */
 };
+#else
+/* Sector pointers in the on-disk inode and in an index block. */
+#define DIRECT_CNT 120
+#define PTRS_PER_SECTOR (DISK_SECTOR_SIZE / sizeof (disk_sector_t))
+
+/* Largest number of data sectors an inode can index. */
+#define MAX_SECTORS (DIRECT_CNT + PTRS_PER_SECTOR \
+		+ PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+
+/* On-disk inode.
+ * Must be exactly DISK_SECTOR_SIZE bytes long.
+ *
+ * Data sectors are found through DIRECT_CNT direct pointers, then
+ * an indirect block of PTRS_PER_SECTOR pointers, then a doubly
+ * indirect block of pointers to such blocks, so a file need not be
+ * contiguous on disk.  A pointer of 0, the free map's inode, marks
+ * a sector that is not allocated; it reads as zeros. */
+struct inode_disk {
+	off_t length;                       /* File size in bytes. */
+	unsigned magic;                     /* Magic number. */
+	disk_sector_t direct[DIRECT_CNT];   /* Direct data sectors. */
+	disk_sector_t indirect;             /* Indirect block. */
+	disk_sector_t doubly_indirect;      /* Doubly indirect block. */
+	uint32_t unused[4];                 /* Not used. */
+};
+
+/* Sectors set aside in the free map for a file to grow into.
+ * They are taken a run at a time, so that the file stays
+ * contiguous on disk even while other files grow alongside. */
+struct reserve {
+	disk_sector_t start;                /* Next sector to hand out. */
+	size_t cnt;                         /* Sectors left to hand out. */
+	size_t size;                        /* Sectors in the next run. */
+	disk_sector_t goal;                 /* Where to look for the next run. */
+};
+
+/* Sectors reserved at a time for a growing file. */
+#define RESERVE_SECTORS 32
+#endif
 
 /* Returns the number of sectors to allocate for an inode SIZE
  * bytes long. */
@@ -33,21 +86,232 @@ struct inode {
 	int open_cnt;                       /* Number of openers. */
 	bool removed;                       /* True if deleted, false otherwise. */
 	int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+#ifdef EFILESYS
+	/* Last cluster visited in the chain, and its index, so that a
+	 * sequential access does not walk the chain from its start. */
+	size_t cursor_idx;
+	cluster_t cursor_clst;              /* 0 if none. */
+#else
+	struct reserve resv;                /* Sectors to grow into. */
+#endif
 	struct inode_disk data;             /* Inode content. */
 };
 
+#ifdef EFILESYS
+/* Appends a cluster of zeros to the chain that ends at CLST, or
+ * starts a chain if CLST is 0.  Returns the new cluster, or 0 if
+ * the disk is full. */
+static cluster_t
+chain_extend (cluster_t clst) {
+	static char zeros[DISK_SECTOR_SIZE];
+	cluster_t new_clst = fat_create_chain (clst);
+	size_t i;
+
+	if (new_clst != 0)
+		for (i = 0; i < SECTORS_PER_CLUSTER; i++)
+			page_cache_write (cluster_to_sector (new_clst) + i, zeros, 0,
+					DISK_SECTOR_SIZE);
+	return new_clst;
+}
+
 /* Returns the disk sector that contains byte offset POS within
- * INODE.
- * Returns -1 if INODE does not contain data for a byte at offset
- * POS. */
+ * INODE, or 0 if the chain does not reach it.  If CREATE is true,
+ * extends the chain as needed, and returns 0 only if the disk is
+ * full.
+ *
+ * The walk starts from the cursor unless POS lies before it, and
+ * leaves the cursor at the cluster found. */
 static disk_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) {
+byte_to_sector (struct inode *inode, off_t pos, bool create) {
+	size_t idx = pos / CLUSTER_SIZE;
+	cluster_t clst;
+	size_t i;
+
 	ASSERT (inode != NULL);
-	if (pos < inode->data.length)
-		return inode->data.start + pos / DISK_SECTOR_SIZE;
-	else
-		return -1;
+	ASSERT (pos >= 0);
+
+	if (inode->data.start == 0) {
+		if (!create || (inode->data.start = chain_extend (0)) == 0)
+			return 0;
+		page_cache_write (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+	}
+
+	if (inode->cursor_clst != 0 && inode->cursor_idx <= idx) {
+		clst = inode->cursor_clst;
+		i = inode->cursor_idx;
+	} else {
+		clst = inode->data.start;
+		i = 0;
+	}
+
+	for (; i < idx; i++) {
+		cluster_t next = fat_get (clst);
+
+		if (next == EOChain
+				&& (!create || (next = chain_extend (clst)) == 0))
+			break;
+		clst = next;
+	}
+
+	inode->cursor_idx = i;
+	inode->cursor_clst = clst;
+	if (i < idx)
+		return 0;
+	return cluster_to_sector (clst)
+		+ pos / DISK_SECTOR_SIZE % SECTORS_PER_CLUSTER;
+}
+
+/* Frees the data clusters of DISK. */
+static void
+release_sectors (struct inode_disk *disk) {
+	if (disk->start != 0)
+		fat_remove_chain (disk->start, 0);
 }
+#else
+
+/* Hands out the next sector of RESV into *SECTORP, reserving
+ * another run from the free map first if RESV is used up.
+ * Returns false if the disk is full. */
+static bool
+reserve_take (struct reserve *resv, disk_sector_t *sectorp) {
+	if (resv->cnt == 0) {
+		resv->cnt = free_map_allocate_run (resv->goal, resv->size, &resv->start);
+		if (resv->cnt == 0)
+			return false;
+	}
+	*sectorp = resv->start++;
+	resv->cnt--;
+	resv->goal = resv->start;
+	return true;
+}
+
+/* Gives the sectors left in RESV back to the free map. */
+static void
+reserve_release (struct reserve *resv) {
+	if (resv->cnt > 0)
+		free_map_release (resv->start, resv->cnt);
+	resv->cnt = 0;
+}
+
+/* Returns the sector in *SLOT.  If there is none and RESV is
+ * nonnull, takes a sector from RESV for it first, fills it with
+ * zeros and sets *CHANGED.  Returns 0 if there is no sector. */
+static disk_sector_t
+slot_get (disk_sector_t *slot, struct reserve *resv, bool *changed) {
+	static char zeros[DISK_SECTOR_SIZE];
+
+	if (*slot == 0 && resv != NULL && reserve_take (resv, slot)) {
+		page_cache_write (*slot, zeros, 0, DISK_SECTOR_SIZE);
+		*changed = true;
+	}
+	return *slot;
+}
+
+/* Like slot_get(), for pointer IDX of index block TABLE. */
+static disk_sector_t
+index_get (disk_sector_t table, size_t idx, struct reserve *resv) {
+	disk_sector_t sector;
+	bool changed = false;
+
+	page_cache_read (table, &sector, idx * sizeof sector, sizeof sector);
+	if (slot_get (&sector, resv, &changed) != 0 && changed)
+		page_cache_write (table, &sector, idx * sizeof sector, sizeof sector);
+	return sector;
+}
+
+/* Returns data sector IDX of DISK, or 0 if it is not allocated.
+ * If RESV is nonnull, allocates it and the index blocks leading to
+ * it from RESV as needed, and sets *CHANGED if DISK itself was
+ * modified.  Returns 0 then only if the disk is full. */
+static disk_sector_t
+index_to_sector (struct inode_disk *disk, size_t idx, struct reserve *resv,
+		bool *changed) {
+	disk_sector_t table;
+
+	if (idx < DIRECT_CNT)
+		return slot_get (&disk->direct[idx], resv, changed);
+	idx -= DIRECT_CNT;
+
+	if (idx < PTRS_PER_SECTOR) {
+		table = slot_get (&disk->indirect, resv, changed);
+		return table != 0 ? index_get (table, idx, resv) : 0;
+	}
+	idx -= PTRS_PER_SECTOR;
+
+	if (idx < PTRS_PER_SECTOR * PTRS_PER_SECTOR) {
+		table = slot_get (&disk->doubly_indirect, resv, changed);
+		if (table != 0)
+			table = index_get (table, idx / PTRS_PER_SECTOR, resv);
+		return table != 0 ? index_get (table, idx % PTRS_PER_SECTOR, resv) : 0;
+	}
+	return 0;
+}
+
+/* Returns the disk sector that contains byte offset POS within
+ * INODE, or 0 if no sector is allocated for it.  If CREATE is
+ * true, allocates the sector if needed, and returns 0 only if the
+ * disk is full. */
+static disk_sector_t
+byte_to_sector (struct inode *inode, off_t pos, bool create) {
+	size_t idx = pos / DISK_SECTOR_SIZE;
+	bool changed = false;
+	disk_sector_t sector;
+
+	ASSERT (inode != NULL);
+	ASSERT (pos >= 0);
+
+	sector = index_to_sector (&inode->data, idx, NULL, NULL);
+	if (sector != 0 || !create)
+		return sector;
+
+	/* Once the reservation is used up, look for the next one right
+	 * after the sector before this one, or after the inode. */
+	if (inode->resv.cnt == 0) {
+		disk_sector_t prev = idx > 0
+			? index_to_sector (&inode->data, idx - 1, NULL, NULL) : 0;
+		inode->resv.goal = (prev != 0 ? prev : inode->sector) + 1;
+	}
+
+	sector = index_to_sector (&inode->data, idx, &inode->resv, &changed);
+	if (changed)
+		page_cache_write (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+	return sector;
+}
+
+/* Frees index block TABLE, and the sectors it points to, which
+ * are index blocks themselves if LEVEL is above 1. */
+static void
+release_table (disk_sector_t table, int level) {
+	size_t i;
+
+	for (i = 0; i < PTRS_PER_SECTOR; i++) {
+		disk_sector_t sector = index_get (table, i, NULL);
+
+		if (sector == 0)
+			continue;
+		if (level > 1)
+			release_table (sector, level - 1);
+		else
+			free_map_release (sector, 1);
+	}
+	free_map_release (table, 1);
+}
+
+/* Frees every sector DISK points to, directly or not. */
+static void
+release_sectors (struct inode_disk *disk) {
+	size_t i;
+
+	for (i = 0; i < DIRECT_CNT; i++)
+		if (disk->direct[i] != 0)
+			free_map_release (disk->direct[i], 1);
+	if (disk->indirect != 0)
+		release_table (disk->indirect, 1);
+	if (disk->doubly_indirect != 0)
+		release_table (disk->doubly_indirect, 2);
+}
+
+#endif
 
 /* List of open inodes, so that opening a single inode twice
  * returns the same `struct inode'. */
@@ -78,19 +342,41 @@ inode_create (disk_sector_t sector, off_t length) {
 	disk_inode = calloc (1, sizeof *disk_inode);
 	if (disk_inode != NULL) {
 		size_t sectors = bytes_to_sectors (length);
+		size_t i;
+
 		disk_inode->length = length;
 		disk_inode->magic = INODE_MAGIC;
-		if (free_map_allocate (sectors, &disk_inode->start)) {
-			disk_write (filesys_disk, sector, disk_inode);
-			if (sectors > 0) {
-				static char zeros[DISK_SECTOR_SIZE];
-				size_t i;
-
-				for (i = 0; i < sectors; i++) 
-					disk_write (filesys_disk, disk_inode->start + i, zeros); 
-			}
-			success = true; 
-		} 
+
+		/* Allocate the data sectors now, zeroed in the buffer cache,
+		 * so that writes within LENGTH never need the free map.  The
+		 * free map file depends on that. */
+		success = sectors <= MAX_SECTORS;
+#ifdef EFILESYS
+		cluster_t clst = 0;
+		for (i = 0; success && i < DIV_ROUND_UP (sectors, SECTORS_PER_CLUSTER);
+				i++) {
+			clst = chain_extend (clst);
+			if (disk_inode->start == 0)
+				disk_inode->start = clst;
+			success = clst != 0;
+		}
+#else
+		/* In one run after the inode if the disk has room, index
+		 * blocks included. */
+		struct reserve resv = {
+			.size = sectors + DIV_ROUND_UP (sectors, PTRS_PER_SECTOR) + 1,
+			.goal = sector + 1,
+		};
+		bool changed;
+		for (i = 0; success && i < sectors; i++)
+			success = index_to_sector (disk_inode, i, &resv, &changed) != 0;
+		reserve_release (&resv);
+#endif
+
+		if (success)
+			page_cache_write (sector, disk_inode, 0, DISK_SECTOR_SIZE);
+		else
+			release_sectors (disk_inode);
 		free (disk_inode);
 	}
 	return success;
@@ -125,7 +411,13 @@ inode_open (disk_sector_t sector) {
 	inode->open_cnt = 1;
 	inode->deny_write_cnt = 0;
 	inode->removed = false;
-	disk_read (filesys_disk, inode->sector, &inode->data);
+#ifdef EFILESYS
+	inode->cursor_idx = 0;
+	inode->cursor_clst = 0;
+#else
+	inode->resv = (struct reserve) { .size = RESERVE_SECTORS };
+#endif
+	page_cache_read (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
 	return inode;
 }
 
@@ -157,11 +449,15 @@ inode_close (struct inode *inode) {
 		/* Remove from inode list and release lock. */
 		list_remove (&inode->elem);
 
+#ifndef EFILESYS
+		/* Give back the sectors it did not grow into. */
+		reserve_release (&inode->resv);
+#endif
+
 		/* Deallocate blocks if removed. */
 		if (inode->removed) {
 			free_map_release (inode->sector, 1);
-			free_map_release (inode->data.start,
-					bytes_to_sectors (inode->data.length)); 
+			release_sectors (&inode->data);
 		}
 
 		free (inode); 
@@ -183,11 +479,10 @@ off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 	uint8_t *buffer = buffer_;
 	off_t bytes_read = 0;
-	uint8_t *bounce = NULL;
 
 	while (size > 0) {
 		/* Disk sector to read, starting byte offset within sector. */
-		disk_sector_t sector_idx = byte_to_sector (inode, offset);
+		disk_sector_t sector_idx = byte_to_sector (inode, offset, false);
 		int sector_ofs = offset % DISK_SECTOR_SIZE;
 
 		/* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -200,93 +495,125 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Read full sector directly into caller's buffer. */
-			disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
-		} else {
-			/* Read sector into bounce buffer, then partially copy
-			 * into caller's buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
-			disk_read (filesys_disk, sector_idx, bounce);
-			memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-		}
+		/* Copy out of the buffer cache.  Sectors never written read
+		 * as zeros. */
+		if (sector_idx != 0)
+			page_cache_read (sector_idx, buffer + bytes_read, sector_ofs,
+					chunk_size);
+		else
+			memset (buffer + bytes_read, 0, chunk_size);
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_read += chunk_size;
 	}
-	free (bounce);
 
 	return bytes_read;
 }
 
+/* Starts reading the SIZE bytes of INODE at OFFSET into the
+ * buffer cache in the background, one run of adjacent sectors at
+ * a time.  Bytes past the end of INODE are ignored. */
+void
+inode_readahead (struct inode *inode, off_t offset, off_t size) {
+	off_t end = offset + size < inode_length (inode)
+		? offset + size : inode_length (inode);
+	disk_sector_t start = 0;
+	size_t cnt = 0;
+#ifdef EFILESYS
+	/* Keep the cursor where the reader is, not where we read
+	 * ahead to. */
+	size_t cursor_idx = inode->cursor_idx;
+	cluster_t cursor_clst = inode->cursor_clst;
+#endif
+
+	for (offset = ROUND_DOWN (offset, DISK_SECTOR_SIZE); offset < end;
+			offset += DISK_SECTOR_SIZE) {
+		disk_sector_t sector = byte_to_sector (inode, offset, false);
+
+		if (sector == 0)
+			continue;
+		if (cnt > 0 && sector != start + cnt) {
+			page_cache_readahead (start, cnt);
+			cnt = 0;
+		}
+		if (cnt++ == 0)
+			start = sector;
+	}
+	if (cnt > 0)
+		page_cache_readahead (start, cnt);
+#ifdef EFILESYS
+	inode->cursor_idx = cursor_idx;
+	inode->cursor_clst = cursor_clst;
+#endif
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
  * Returns the number of bytes actually written, which may be
- * less than SIZE if end of file is reached or an error occurs.
- * (Normally a write at end of file would extend the inode, but
- * growth is not yet implemented.) */
+ * less than SIZE if the disk is full.  A write past the end of
+ * INODE extends it; the bytes skipped over read as zeros. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		off_t offset) {
 	const uint8_t *buffer = buffer_;
 	off_t bytes_written = 0;
-	uint8_t *bounce = NULL;
 
 	if (inode->deny_write_cnt)
 		return 0;
 
 	while (size > 0) {
 		/* Sector to write, starting byte offset within sector. */
-		disk_sector_t sector_idx = byte_to_sector (inode, offset);
+		disk_sector_t sector_idx;
 		int sector_ofs = offset % DISK_SECTOR_SIZE;
 
-		/* Bytes left in inode, bytes left in sector, lesser of the two. */
-		off_t inode_left = inode_length (inode) - offset;
+		/* Bytes left in sector, and the number of bytes to actually
+		 * write into it. */
 		int sector_left = DISK_SECTOR_SIZE - sector_ofs;
-		int min_left = inode_left < sector_left ? inode_left : sector_left;
+		int chunk_size = size < sector_left ? size : sector_left;
 
-		/* Number of bytes to actually write into this sector. */
-		int chunk_size = size < min_left ? size : min_left;
-		if (chunk_size <= 0)
+		if (offset / DISK_SECTOR_SIZE >= (off_t) MAX_SECTORS)
+			break;
+		sector_idx = byte_to_sector (inode, offset, true);
+		if (sector_idx == 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Write full sector directly to disk. */
-			disk_write (filesys_disk, sector_idx, buffer + bytes_written); 
-		} else {
-			/* We need a bounce buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
-
-			/* If the sector contains data before or after the chunk
-			   we're writing, then we need to read in the sector
-			   first.  Otherwise we start with a sector of all zeros. */
-			if (sector_ofs > 0 || chunk_size < sector_left) 
-				disk_read (filesys_disk, sector_idx, bounce);
-			else
-				memset (bounce, 0, DISK_SECTOR_SIZE);
-			memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-			disk_write (filesys_disk, sector_idx, bounce); 
-		}
+		/* Copy into the buffer cache, which reads in the rest of
+		   the sector first if the chunk does not cover it. */
+		page_cache_write (sector_idx, buffer + bytes_written, sector_ofs,
+				chunk_size);
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_written += chunk_size;
 	}
-	free (bounce);
+
+	/* Grow the file over what was written, if anything was; a
+	 * write that got no sector leaves the length alone. */
+	if (bytes_written > 0 && offset > inode->data.length) {
+		inode->data.length = offset;
+		page_cache_write (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+	}
 
 	return bytes_written;
 }
 
+/* Gives INODE zeroed sectors for its first LENGTH bytes, where it
+ * has none yet, without changing its length.  Returns true if
+ * successful, false if the disk is full.  Sectors allocated before
+ * a failure stay with INODE and are freed along with it. */
+bool
+inode_allocate (struct inode *inode, off_t length) {
+	off_t ofs;
+
+	for (ofs = 0; ofs < length; ofs += DISK_SECTOR_SIZE)
+		if (ofs / DISK_SECTOR_SIZE >= (off_t) MAX_SECTORS
+				|| byte_to_sector (inode, ofs, true) == 0)
+			return false;
+	return true;
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 	void
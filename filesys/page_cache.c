@@ -1,50 +1,458 @@
 /* page_cache.c: Implementation of Page Cache (Buffer Cache). */
 
-#include "vm/vm.h"
-static bool page_cache_readahead (struct page *page, void *kva);
-static bool page_cache_writeback (struct page *page);
-static void page_cache_destroy (struct page *page);
-
-/* DO NOT MODIFY this struct */
-static const struct page_operations page_cache_op = {
-	.swap_in = page_cache_readahead,
-	.swap_out = page_cache_writeback,
-	.destroy = page_cache_destroy,
-	.type = VM_PAGE_CACHE,
+#include "filesys/page_cache.h"
+#include <debug.h>
+#include <hash.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "devices/timer.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Buffer cache of file system sectors.
+
+   Every sector that the file system reads or writes goes through
+   one of CACHE_CNT entries.  Entries are found by sector through
+   a hash table, and replaced in clock order: the hand skips and
+   clears entries that were used since it last passed them, and
+   takes the first one that was not.  Writes only mark the entry
+   dirty, so writers return as soon as their data is cached.
+
+   Dirty sectors are written behind by page_cache_kworkerd (),
+   which is woken by the first write to a clean cache.  It lets
+   writes gather for FLUSH_DELAY ticks, or less once DIRTY_HIGH
+   sectors are dirty, then writes them all back in sector order,
+   runs of adjacent sectors with a single disk command each.  A
+   dirty entry that is replaced before then is written back
+   synchronously.  page_cache_flush () drains the cache.
+
+   One lock protects the cache.  A miss reads the sector without
+   it: the entry is marked as being read, and readers of the
+   sector wait for it on IO_DONE.  The daemon writes back without
+   the lock too: it copies a run of sectors out under the lock
+   and marks their entries as being written, which keeps them
+   from being replaced, and so read back from the disk, before
+   the write completes.
+
+   Sequential readers ask for the sectors ahead of them with
+   page_cache_readahead ().  page_cache_readaheadd () claims
+   entries for the ones not cached yet and marks them as being
+   read, reads them with one disk command per run, and fills the
+   entries in.  Readers of such an entry wait for it on IO_DONE,
+   all others keep using the cache meanwhile.
+
+   Copies to and from user buffers are done without CACHE_LOCK,
+   as touching a page that is not loaded yet faults, and loading
+   or evicting it reads or writes a file through the cache.  The
+   entry is kept from being replaced meanwhile. */
+
+#define CACHE_CNT 64
+#define FLUSH_DELAY (TIMER_FREQ / 2)      /* Ticks writes gather. */
+#define FLUSH_SLICE (TIMER_FREQ / 20)     /* Ticks between checks. */
+#define DIRTY_HIGH (CACHE_CNT / 2)        /* Dirty sectors to flush at. */
+#define FLUSH_MAX (CACHE_CNT / 2)         /* Sectors written per pass. */
+#define RUN_MAX (PGSIZE / DISK_SECTOR_SIZE) /* Sectors per disk command. */
+#define RA_QUEUE 8                        /* Pending readahead requests. */
+
+/* A cached sector. */
+struct cache_entry {
+	struct hash_elem elem;      /* In CACHE_MAP, if valid. */
+	disk_sector_t sector;       /* Sector held. */
+	bool valid;                 /* Holds SECTOR. */
+	bool dirty;                 /* Differs from the disk. */
+	bool accessed;              /* Used since the clock hand passed. */
+	bool writing;               /* Being written back, do not replace. */
+	bool reading;               /* Being read in, DATA not ready. */
+	int copy_cnt;               /* Copies to or from user memory. */
+	uint8_t *data;              /* DISK_SECTOR_SIZE bytes. */
 };
 
-tid_t page_cache_workerd;
+static struct cache_entry cache[CACHE_CNT];
+static struct hash cache_map;
+static struct lock cache_lock;
+static size_t clock_hand;
+static size_t dirty_cnt;
+static struct condition io_done;    /* An entry was read in. */
+
+/* Write-behind. */
+static struct lock flush_lock;      /* Serializes write-backs. */
+static struct semaphore flush_wake; /* Wakes page_cache_kworkerd (). */
+static bool flush_pending;          /* FLUSH_WAKE was raised. */
+static uint8_t *flush_buf;          /* RUN_MAX sectors. */
+
+static void page_cache_kworkerd (void *aux);
+
+/* Readahead, a queue of runs of sectors protected by CACHE_LOCK. */
+struct ra_request {
+	disk_sector_t sector;       /* First sector. */
+	size_t cnt;                 /* Number of sectors. */
+};
+static struct ra_request ra_queue[RA_QUEUE];
+static size_t ra_head, ra_cnt;
+static struct semaphore ra_wake;    /* Counts requests in RA_QUEUE. */
+static uint8_t *ra_buf;             /* RUN_MAX sectors. */
+
+static void page_cache_readaheadd (void *aux);
+
+/* Statistics. */
+static long long hit_cnt, miss_cnt, readahead_cnt, writeback_cnt;
+
+static uint64_t
+cache_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct cache_entry *c = hash_entry (e, struct cache_entry, elem);
+	return hash_int (c->sector);
+}
+
+static bool
+cache_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct cache_entry, elem)->sector
+		< hash_entry (b, struct cache_entry, elem)->sector;
+}
 
-/* The initializer of file vm */
+/* Initializes the buffer cache. */
 void
-pagecache_init (void) {
-	/* TODO: Create a worker daemon for page cache with page_cache_kworkerd */
+page_cache_init (void) {
+	size_t per_page = PGSIZE / DISK_SECTOR_SIZE;
+	uint8_t *data = palloc_get_multiple (PAL_ASSERT,
+			DIV_ROUND_UP (CACHE_CNT, per_page));
+	size_t i;
+
+	if (!hash_init (&cache_map, cache_hash, cache_less, NULL))
+		PANIC ("page_cache_init() out of memory");
+	lock_init (&cache_lock);
+	for (i = 0; i < CACHE_CNT; i++) {
+		cache[i].valid = false;
+		cache[i].writing = false;
+		cache[i].reading = false;
+		cache[i].copy_cnt = 0;
+		cache[i].data = data + i * DISK_SECTOR_SIZE;
+	}
+	clock_hand = 0;
+	dirty_cnt = 0;
+	cond_init (&io_done);
+
+	lock_init (&flush_lock);
+	sema_init (&flush_wake, 0);
+	flush_pending = false;
+	flush_buf = palloc_get_page (PAL_ASSERT);
+	if (thread_create ("page_cache_kworkerd", PRI_DEFAULT,
+				page_cache_kworkerd, NULL) == TID_ERROR)
+		PANIC ("cannot start buffer cache flusher");
+
+	ra_head = ra_cnt = 0;
+	sema_init (&ra_wake, 0);
+	ra_buf = palloc_get_page (PAL_ASSERT);
+	if (thread_create ("page_cache_readaheadd", PRI_DEFAULT,
+				page_cache_readaheadd, NULL) == TID_ERROR)
+		PANIC ("cannot start buffer cache readahead");
+}
+
+/* Writes entry C back to the disk if it is dirty. */
+static void
+cache_writeback (struct cache_entry *c) {
+	if (c->valid && c->dirty) {
+		disk_write (filesys_disk, c->sector, c->data);
+		c->dirty = false;
+		dirty_cnt--;
+		writeback_cnt++;
+	}
 }
 
-/* Initialize the page cache */
-bool
-page_cache_initializer (struct page *page, enum vm_type type, void *kva) {
-	/* Set up the handler */
-	page->operations = &page_cache_op;
+/* Returns the entry holding SECTOR, or a null pointer. */
+static struct cache_entry *
+cache_lookup (disk_sector_t sector) {
+	struct cache_entry key;
+	struct hash_elem *e;
 
+	key.sector = sector;
+	e = hash_find (&cache_map, &key.elem);
+	return e != NULL ? hash_entry (e, struct cache_entry, elem) : NULL;
 }
 
-/* Utilze the Swap in mechanism to implement readhead */
-static bool
-page_cache_readahead (struct page *page, void *kva) {
+/* Makes an entry hold SECTOR, replacing one that was not used
+   lately, and returns it.  Its data is not read in. */
+static struct cache_entry *
+cache_install (disk_sector_t sector) {
+	struct cache_entry *c;
+
+	/* Run the clock hand to an entry that was not used lately. */
+	for (;;) {
+		c = &cache[clock_hand];
+		clock_hand = (clock_hand + 1) % CACHE_CNT;
+		if (c->writing || c->reading || c->copy_cnt > 0)
+			continue;
+		if (!c->valid || !c->accessed)
+			break;
+		c->accessed = false;
+	}
+
+	if (c->valid) {
+		cache_writeback (c);
+		hash_delete (&cache_map, &c->elem);
+	}
+	c->sector = sector;
+	c->valid = true;
+	c->dirty = false;
+	c->accessed = true;
+	hash_insert (&cache_map, &c->elem);
+	return c;
 }
 
-/* Utilze the Swap out mechanism to implement writeback */
-static bool
-page_cache_writeback (struct page *page) {
+/* Returns the entry holding SECTOR, replacing another one if it
+   is not cached.  Reads the sector from the disk, unless READ is
+   false because the caller overwrites all of it. */
+static struct cache_entry *
+cache_get (disk_sector_t sector, bool read) {
+	struct cache_entry *c;
+
+	ASSERT (lock_held_by_current_thread (&cache_lock));
+
+	/* Wait for a read of SECTOR in progress, then look again,
+	   since the entry may be replaced before we run. */
+	while ((c = cache_lookup (sector)) != NULL) {
+		if (!c->reading) {
+			hit_cnt++;
+			c->accessed = true;
+			return c;
+		}
+		cond_wait (&io_done, &cache_lock);
+	}
+	miss_cnt++;
+
+	c = cache_install (sector);
+	if (read) {
+		/* READING keeps C from being replaced, or used before
+		   its data is in, while the lock is dropped. */
+		c->reading = true;
+		lock_release (&cache_lock);
+		disk_read (filesys_disk, sector, c->data);
+		lock_acquire (&cache_lock);
+		c->reading = false;
+		cond_broadcast (&io_done, &cache_lock);
+	}
+	return c;
 }
 
-/* Destory the page_cache. */
+/* Copies SIZE bytes at offset OFS of SECTOR into BUFFER. */
+void
+page_cache_read (disk_sector_t sector, void *buffer, off_t ofs,
+		size_t size) {
+	struct cache_entry *c;
+
+	ASSERT (ofs >= 0 && ofs + size <= DISK_SECTOR_SIZE);
+
+	lock_acquire (&cache_lock);
+	c = cache_get (sector, true);
+	if (is_user_vaddr (buffer)) {
+		c->copy_cnt++;
+		lock_release (&cache_lock);
+		memcpy (buffer, c->data + ofs, size);
+		lock_acquire (&cache_lock);
+		c->copy_cnt--;
+	} else
+		memcpy (buffer, c->data + ofs, size);
+	lock_release (&cache_lock);
+}
+
+/* Copies SIZE bytes from BUFFER to offset OFS of SECTOR. */
+void
+page_cache_write (disk_sector_t sector, const void *buffer, off_t ofs,
+		size_t size) {
+	struct cache_entry *c;
+
+	ASSERT (ofs >= 0 && ofs + size <= DISK_SECTOR_SIZE);
+
+	lock_acquire (&cache_lock);
+	c = cache_get (sector, size < DISK_SECTOR_SIZE);
+	if (is_user_vaddr (buffer)) {
+		c->copy_cnt++;
+		lock_release (&cache_lock);
+		memcpy (c->data + ofs, buffer, size);
+		lock_acquire (&cache_lock);
+		c->copy_cnt--;
+	} else
+		memcpy (c->data + ofs, buffer, size);
+
+	/* Dirty only now, so a write-back that copied the entry while
+	   BUFFER was being copied in is followed by another. */
+	if (!c->dirty) {
+		c->dirty = true;
+		dirty_cnt++;
+	}
+
+	/* Start the flusher on the first dirty sector. */
+	if (!flush_pending) {
+		flush_pending = true;
+		sema_up (&flush_wake);
+	}
+	lock_release (&cache_lock);
+}
+
+/* Asks for the CNT sectors from SECTOR to be read into the cache
+   in the background.  The request is dropped if too many are
+   pending already. */
+void
+page_cache_readahead (disk_sector_t sector, size_t cnt) {
+	lock_acquire (&cache_lock);
+	if (ra_cnt < RA_QUEUE) {
+		struct ra_request *r = &ra_queue[(ra_head + ra_cnt++) % RA_QUEUE];
+
+		r->sector = sector;
+		r->cnt = cnt;
+		sema_up (&ra_wake);
+	}
+	lock_release (&cache_lock);
+}
+
+/* Writes up to FLUSH_MAX dirty sectors back to the disk, in
+   sector order.  Returns the number written.  FLUSH_LOCK must be
+   held. */
+static size_t
+page_cache_writeback (void) {
+	struct cache_entry *batch[FLUSH_MAX];
+	size_t cnt = 0, i, j;
+
+	ASSERT (lock_held_by_current_thread (&flush_lock));
+
+	/* Take the dirty entries, sorted by sector. */
+	lock_acquire (&cache_lock);
+	for (i = 0; i < CACHE_CNT && cnt < FLUSH_MAX; i++) {
+		struct cache_entry *c = &cache[i];
+
+		if (!c->valid || !c->dirty)
+			continue;
+		for (j = cnt++; j > 0 && batch[j - 1]->sector > c->sector; j--)
+			batch[j] = batch[j - 1];
+		batch[j] = c;
+		c->writing = true;
+	}
+	lock_release (&cache_lock);
+
+	/* Write each run of adjacent sectors with one command.  An entry
+	   written to while its copy is on the way is dirty again. */
+	for (i = 0; i < cnt; i = j) {
+		lock_acquire (&cache_lock);
+		for (j = i; j < cnt && j - i < RUN_MAX
+				&& batch[j]->sector == batch[i]->sector + (j - i); j++) {
+			memcpy (flush_buf + (j - i) * DISK_SECTOR_SIZE, batch[j]->data,
+					DISK_SECTOR_SIZE);
+			batch[j]->dirty = false;
+			dirty_cnt--;
+		}
+		lock_release (&cache_lock);
+
+		disk_write_multiple (filesys_disk, batch[i]->sector, j - i, flush_buf);
+
+		lock_acquire (&cache_lock);
+		while (i < j) {
+			batch[i++]->writing = false;
+			writeback_cnt++;
+		}
+		lock_release (&cache_lock);
+	}
+	return cnt;
+}
+
+/* Writes every dirty sector back to the disk. */
+void
+page_cache_flush (void) {
+	lock_acquire (&flush_lock);
+	while (page_cache_writeback () > 0)
+		continue;
+	lock_release (&flush_lock);
+}
+
+/* Reads ahead the runs of sectors of R that are not cached. */
+static void
+readahead_run (struct ra_request *r) {
+	struct cache_entry *batch[RUN_MAX];
+	disk_sector_t sector = r->sector;
+	disk_sector_t end = r->sector + r->cnt;
+
+	while (sector < end) {
+		disk_sector_t start;
+		size_t cnt = 0, i;
+
+		/* Claim entries up to the next cached sector. */
+		lock_acquire (&cache_lock);
+		while (sector < end && cache_lookup (sector) != NULL)
+			sector++;
+		start = sector;
+		while (sector < end && cnt < RUN_MAX && cache_lookup (sector) == NULL) {
+			batch[cnt] = cache_install (sector++);
+			batch[cnt++]->reading = true;
+		}
+		lock_release (&cache_lock);
+		if (cnt == 0)
+			break;
+
+		disk_read_multiple (filesys_disk, start, cnt, ra_buf);
+
+		lock_acquire (&cache_lock);
+		for (i = 0; i < cnt; i++) {
+			memcpy (batch[i]->data, ra_buf + i * DISK_SECTOR_SIZE,
+					DISK_SECTOR_SIZE);
+			batch[i]->reading = false;
+		}
+		readahead_cnt += cnt;
+		cond_broadcast (&io_done, &cache_lock);
+		lock_release (&cache_lock);
+	}
+}
+
+/* Readahead worker thread.  Serves page_cache_readahead () requests,
+   see the comment at the top of the file. */
 static void
-page_cache_destroy (struct page *page) {
+page_cache_readaheadd (void *aux UNUSED) {
+	for (;;) {
+		struct ra_request r;
+
+		sema_down (&ra_wake);
+		lock_acquire (&cache_lock);
+		r = ra_queue[ra_head];
+		ra_head = (ra_head + 1) % RA_QUEUE;
+		ra_cnt--;
+		lock_release (&cache_lock);
+
+		readahead_run (&r);
+	}
 }
 
-/* Worker thread for page cache */
+/* Worker thread for page cache.  Writes dirty sectors behind the
+   writers, see the comment at the top of the file. */
 static void
-page_cache_kworkerd (void *aux) {
+page_cache_kworkerd (void *aux UNUSED) {
+	for (;;) {
+		bool again;
+
+		sema_down (&flush_wake);
+		do {
+			int64_t slept;
+
+			for (slept = 0; slept < FLUSH_DELAY && dirty_cnt < DIRTY_HIGH;
+					slept += FLUSH_SLICE)
+				timer_sleep (FLUSH_SLICE);
+
+			lock_acquire (&flush_lock);
+			page_cache_writeback ();
+			lock_release (&flush_lock);
+
+			lock_acquire (&cache_lock);
+			again = flush_pending = dirty_cnt > 0;
+			lock_release (&cache_lock);
+		} while (again);
+	}
+}
+
+/* Prints buffer cache statistics. */
+void
+page_cache_print_stats (void) {
+	printf ("Buffer cache: %lld hits, %lld misses, %lld read ahead, "
+			"%lld write-backs\n", hit_cnt, miss_cnt, readahead_cnt,
+			writeback_cnt);
 }
@@ -37,6 +37,23 @@ static __inline void invlpg(uint64_t addr) {
 	__asm __volatile("invlpg (%0)" : : "r" (addr) : "memory");
 }
 
+/* Fills the page at KVA with zeros, eight bytes per iteration
+   of "rep stosq". */
+__attribute__((always_inline))
+static __inline void zero_page(void *kva) {
+	uint64_t cnt = PGSIZE / sizeof (uint64_t);
+	__asm __volatile("rep stosq"
+			: "+D" (kva), "+c" (cnt) : "a" (0ULL) : "memory");
+}
+
+/* Returns the time stamp counter, in cycles. */
+__attribute__((always_inline))
+static __inline uint64_t rdtsc(void) {
+	uint32_t lo, hi;
+	__asm __volatile("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t) hi << 32) | lo;
+}
+
 __attribute__((always_inline))
 static __inline uint64_t read_eflags(void) {
 	uint64_t rflags;
@@ -11,6 +11,10 @@ enum palloc_flags {
 	PAL_USER = 004              /* User page. */
 };
 
+/* Orders of the blocks of the page allocator, which hand out up
+   to 2**(PALLOC_ORDERS - 1) contiguous pages at once. */
+#define PALLOC_ORDERS 20
+
 /* Maximum number of pages to put in user pool. */
 extern size_t user_page_limit;
 
@@ -19,6 +23,8 @@ void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+void palloc_get_stats (enum palloc_flags, size_t free_cnt[PALLOC_ORDERS]);
+void palloc_print_stats (void);
 int get_pages_size (void);
 void * get_base (void); 
 
@@ -13,16 +13,9 @@ int process_wait (tid_t);
 void process_exit (void);
 void process_activate (struct thread *next);
 
+void process_cache_init (void);
 struct child_list_elem *process_set_child_list (struct thread *parent,
                                                 struct thread *child);
 int get_child_exit_status (struct thread *parent, tid_t child_tid);
 
-struct load_seg_args {
-  struct file *file;
-  off_t ofs;
-  size_t page_read_bytes;
-  size_t page_zero_bytes;
-  size_t read_bytes;
-};
-
 #endif /* userprog/process.h */
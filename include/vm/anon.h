@@ -4,16 +4,25 @@
 struct page;
 enum vm_type;
 
+/* Pages evicted and read back from swap together. */
+#define SWAP_CLUSTER 8
+
+/* No swap slot. */
+#define SWAP_SLOT_NONE ((size_t) -1)
+
 typedef bool vm_initializer (struct page *, void *aux);
 
 struct anon_page {
   vm_initializer *init;
   void *aux;
-  size_t swap_slot;
-  bool is_swapped_out;
+  size_t swap_slot;    /* Slot holding a copy of the page, or SWAP_SLOT_NONE. */
+  bool is_swapped_out; /* Not resident. */
+  bool clean_init;     /* Unmodified since INIT or zero-filling. */
 };
 
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+bool anon_swap_out_cluster (struct page *pages[], size_t cnt);
+bool anon_is_clean (struct page *page);
 
 #endif
@@ -0,0 +1,54 @@
+#ifndef VM_AREA_H
+#define VM_AREA_H
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+#include "vm/vm.h"
+
+struct file;
+struct page;
+struct supplemental_page_table;
+
+/* A region of the user address space: an executable segment, a file
+ * mapping or the stack. Its pages are created on their first fault, and
+ * all share the area as their aux. */
+struct vm_area {
+  void *start;       /* First page. */
+  void *end;         /* Past the last page. */
+  enum vm_type type; /* Type of the pages, with markers. */
+  bool writable;
+
+  struct file *file; /* Backing file, a reference of our own, or NULL. */
+  off_t ofs;         /* Offset of START in FILE. */
+  size_t read_bytes; /* Bytes read from FILE, the rest reads zeros. */
+
+  /* Pages read ahead by fault-around, see vm_area_read (). */
+  void *prefetch;
+  void *prefetch_va;
+  size_t prefetch_cnt;
+
+  struct list_elem elem; /* In the list of areas, sorted by START. */
+};
+
+void vm_area_init (void);
+struct vm_area *vm_area_create (struct supplemental_page_table *spt,
+                                void *start, size_t size, enum vm_type type,
+                                bool writable, struct file *file, off_t ofs,
+                                size_t read_bytes);
+void vm_area_destroy (struct supplemental_page_table *spt,
+                      struct vm_area *area);
+bool vm_area_copy (struct supplemental_page_table *dst,
+                   struct supplemental_page_table *src);
+
+struct vm_area *vm_area_find (struct supplemental_page_table *spt,
+                              const void *va);
+struct vm_area *vm_area_next (struct supplemental_page_table *spt,
+                              const void *va);
+struct page *vm_area_page (struct supplemental_page_table *spt, void *va);
+
+off_t vm_area_page_ofs (const struct vm_area *area, const void *va);
+size_t vm_area_page_read_bytes (const struct vm_area *area, const void *va);
+bool vm_area_read (struct vm_area *area, const void *va, void *kva);
+
+#endif /* vm/area.h */
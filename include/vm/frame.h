@@ -0,0 +1,52 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "threads/synch.h"
+
+struct page;
+struct text_page;
+
+/* The representation of "frame" */
+struct frame {
+  void *kva;         /* Kernel virtual address of the frame. */
+  struct page *page; /* Owner, the first page of PAGES, or NULL. */
+
+  /* Per-frame state, protected by LOCK. */
+  struct lock lock;
+  struct list pages; /* Reverse map: every page mapping this frame. */
+  int ref_cnt;       /* Length of PAGES, more than 1 if shared. */
+  int pin_cnt;       /* Pinned frames are never evicted. */
+  uint8_t age;       /* Reference history, the last scan in the high bit. */
+  bool dirty;        /* Written through a mapping that is gone since. */
+  struct text_page *text; /* Shared executable page held, or NULL. */
+
+  /* Frame table state, protected by the frame table lock. */
+  struct list_elem free_elem; /* Element in the free frame list. */
+  struct list_elem lru_elem;  /* Element in an active/inactive list. */
+  struct list *lru;           /* List holding LRU_ELEM, or NULL. */
+  bool deferred;              /* Passed over once for being dirty. */
+  bool evicting;              /* Victim of an eviction in progress. */
+};
+
+/* Watermarks of the page reclaim daemon, in frames. */
+extern size_t vm_low_watermark;
+extern size_t vm_high_watermark;
+
+void frame_table_init (void);
+const char *frame_policy_name (void);
+
+struct frame *frame_alloc (void);
+struct frame *frame_lookup (const void *kva);
+bool frame_has_room (size_t cnt);
+
+void frame_link (struct frame *frame, struct page *page);
+void frame_unlink (struct frame *frame, struct page *page);
+bool frame_is_dirty (struct frame *frame);
+
+struct frame *frame_pin_page (struct page *page);
+void frame_unpin (struct frame *frame);
+
+#endif /* vm/frame.h */
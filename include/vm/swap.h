@@ -0,0 +1,28 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "threads/synch.h"
+
+struct disk;
+
+/* A request to move CNT pages between swap slots starting at SLOT and the
+ * kernel buffer BUF. Filled by the submitter, owned by the swap I/O worker
+ * until DONE is up'd. */
+struct swap_io {
+  struct list_elem elem;
+  bool write;            /* True: memory to disk, false: disk to memory. */
+  size_t slot;           /* First swap slot. */
+  size_t cnt;            /* Number of pages. */
+  void *buf;             /* CNT contiguous pages of kernel memory. */
+  struct semaphore done; /* Up'd by the worker once the I/O completed. */
+};
+
+void swap_io_init (struct disk *disk);
+void swap_io_submit (struct swap_io *io);
+void swap_io_wait (struct swap_io *io);
+void swap_io_read (size_t slot, void *kva);
+void swap_io_write (size_t slot, const void *kva);
+
+#endif
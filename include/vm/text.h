@@ -0,0 +1,18 @@
+#ifndef VM_TEXT_H
+#define VM_TEXT_H
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+struct file;
+struct frame;
+struct page;
+
+void text_init (void);
+bool text_share (struct page *page, struct file *file, off_t ofs,
+                 size_t read_bytes);
+void text_add (struct frame *frame, struct file *file, off_t ofs,
+               size_t read_bytes);
+void text_forget (struct frame *frame);
+
+#endif /* vm/text.h */
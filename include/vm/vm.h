@@ -2,7 +2,6 @@
 #define VM_VM_H
 #include <stdbool.h>
 #include "threads/palloc.h"
-#include "hash.h"
 
 enum vm_type {
   /* page not initialized */
@@ -26,14 +25,17 @@ enum vm_type {
   VM_MARKER_END = (1 << 31),
 };
 
+#include "vm/frame.h"
 #include "vm/uninit.h"
 #include "vm/anon.h"
 #include "vm/file.h"
+#include "vm/area.h"
 #ifdef EFILESYS
 #include "filesys/page_cache.h"
 #endif
 
 struct page_operations;
+struct spt_node;
 struct thread;
 
 #define VM_TYPE(type) ((type) &7)
@@ -50,9 +52,8 @@ struct page {
 
   /* Your implementation */
   enum vm_type type;
-  size_t mmap_length;
-  struct hash_elem elem;
-  struct list_elem mmap_elem;
+  struct list_elem frame_elem; /* Element in frame's sharer list. */
+  bool zero; /* Mapped read-only to the shared zero page. */
 
   uint64_t *pml4; /* Page map level 4 */
 
@@ -68,12 +69,6 @@ struct page {
   };
 };
 
-/* The representation of "frame" */
-struct frame {
-  void *kva;
-  struct page *page;
-};
-
 /* The function table for page operations.
  * This is one way of implementing "interface" in C.
  * Put the table of "method" into the struct's member, and
@@ -95,8 +90,9 @@ struct page_operations {
  * We don't want to force you to obey any specific design for this struct.
  * All designs up to you for this. */
 struct supplemental_page_table {
-  struct hash page_table;
-  struct list mapped_pages;
+  struct spt_node *root; /* Radix tree of pages, see vm/spt.c. */
+  struct list areas; /* Regions of the address space, see vm/area.c. */
+  void *next_fault; /* Where a sequential scan would fault next. */
 };
 
 #include "threads/thread.h"
@@ -104,11 +100,29 @@ void supplemental_page_table_init (struct supplemental_page_table *spt);
 bool supplemental_page_table_copy (struct supplemental_page_table *dst,
                                    struct supplemental_page_table *src);
 void supplemental_page_table_kill (struct supplemental_page_table *spt);
+void spt_init (void);
 struct page *spt_find_page (struct supplemental_page_table *spt, void *va);
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
+struct page *spt_next_page (struct supplemental_page_table *spt, void *va);
+void spt_clear (struct supplemental_page_table *spt,
+                void (*destructor) (struct page *));
+
+/* VM statistics. */
+struct vm_stats {
+  long long faults;    /* Page faults handled. */
+  long long page_ins;  /* Pages brought into a frame. */
+  long long shared;    /* Executable pages mapped from another process. */
+  long long evictions; /* Pages evicted. */
+  long long scans;     /* Frames inspected while looking for victims. */
+};
+
+extern struct vm_stats vm_stats;
 
 void vm_init (void);
+bool vm_alloc_stack_page (void *addr);
+bool vm_set_policy (const char *name);
+void vm_print_stats (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
                           bool write, bool not_present);
 
@@ -118,6 +132,7 @@ bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
                                      bool writable, vm_initializer *init,
                                      void *aux);
 void vm_dealloc_page (struct page *page);
+void vm_release_frame (struct page *page);
 bool vm_claim_page (void *va);
 enum vm_type page_get_type (struct page *page);
 
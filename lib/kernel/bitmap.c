@@ -27,6 +27,7 @@ typedef unsigned long elem_type;
 struct bitmap {
 	size_t bit_cnt;     /* Number of bits. */
 	elem_type *bits;    /* Elements that represent bits. */
+	size_t free_hint;   /* No bit below this index is false. */
 };
 
 /* Returns the index of the element that contains the bit
@@ -63,6 +64,50 @@ last_mask (const struct bitmap *b) {
 	return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Returns the number of bits set in WORD.  GCC's
+   __builtin_popcountl() would call into libgcc, which the kernel
+   is not linked with. */
+static inline size_t
+popcount (elem_type word) {
+	word = word - ((word >> 1) & 0x5555555555555555UL);
+	word = (word & 0x3333333333333333UL) + ((word >> 2) & 0x3333333333333333UL);
+	word = (word + (word >> 4)) & 0x0f0f0f0f0f0f0f0fUL;
+	return (word * 0x0101010101010101UL) >> 56;
+}
+
+/* Returns the index of the first bit in B at or after START and
+   before END that is set to VALUE, or END if there is none.
+   Reads a whole element at a time. */
+static size_t
+find_next (const struct bitmap *b, size_t start, size_t end, bool value) {
+	elem_type flip = value ? 0 : (elem_type) -1;
+	size_t idx = elem_idx (start);
+	elem_type word;
+
+	if (start >= end)
+		return end;
+
+	/* Bits before START in the first element don't count. */
+	word = (b->bits[idx] ^ flip) & ~(bit_mask (start) - 1);
+	while (word == 0) {
+		if (++idx >= elem_cnt (end))
+			return end;
+		word = b->bits[idx] ^ flip;
+	}
+	start = idx * ELEM_BITS + __builtin_ctzl (word);
+	return start < end ? start : end;
+}
+
+/* Sets the bits of MASK in element IDX of B to VALUE.  The
+   element is updated atomically, like a single bit. */
+static inline void
+set_elem_bits (struct bitmap *b, size_t idx, elem_type mask, bool value) {
+	if (value)
+		asm ("lock orq %1, %0" : "+m" (b->bits[idx]) : "r" (mask) : "cc");
+	else
+		asm ("lock andq %1, %0" : "+m" (b->bits[idx]) : "r" (~mask) : "cc");
+}
+
 /* Creation and destruction. */
 
 /* Initializes B to be a bitmap of BIT_CNT bits
@@ -75,6 +120,7 @@ bitmap_create (size_t bit_cnt) {
 	if (b != NULL) {
 		b->bit_cnt = bit_cnt;
 		b->bits = malloc (byte_cnt (bit_cnt));
+		b->free_hint = 0;
 		if (b->bits != NULL || bit_cnt == 0) {
 			bitmap_set_all (b, false);
 			return b;
@@ -95,6 +141,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED) {
 
 	b->bit_cnt = bit_cnt;
 	b->bits = (elem_type *) (b + 1);
+	b->free_hint = 0;
 	bitmap_set_all (b, false);
 	return b;
 }
@@ -160,6 +207,8 @@ bitmap_reset (struct bitmap *b, size_t bit_idx) {
 	   is guaranteed to be atomic on a uniprocessor machine.  See
 	   the description of the AND instruction in [IA32-v2a]. */
 	asm ("lock andq %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+	if (bit_idx < b->free_hint)
+		b->free_hint = bit_idx;
 }
 
 /* Atomically toggles the bit numbered IDX in B;
@@ -174,6 +223,8 @@ bitmap_flip (struct bitmap *b, size_t bit_idx) {
 	   is guaranteed to be atomic on a uniprocessor machine.  See
 	   the description of the XOR instruction in [IA32-v2b]. */
 	asm ("lock xorq %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+	if (bit_idx < b->free_hint)
+		b->free_hint = bit_idx;
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -197,47 +248,74 @@ bitmap_set_all (struct bitmap *b, bool value) {
 /* Sets the CNT bits starting at START in B to VALUE. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
+	size_t end = start + cnt;
+	size_t idx, last;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		bitmap_set (b, start + i, value);
+	if (cnt == 0)
+		return;
+
+	/* Partial elements at either end, whole ones in between. */
+	idx = elem_idx (start);
+	last = elem_idx (end - 1);
+	if (idx == last)
+		set_elem_bits (b, idx, ~(bit_mask (start) - 1)
+				& (bit_mask (end - 1) | (bit_mask (end - 1) - 1)), value);
+	else {
+		set_elem_bits (b, idx, ~(bit_mask (start) - 1), value);
+		for (idx++; idx < last; idx++)
+			b->bits[idx] = value ? (elem_type) -1 : 0;
+		set_elem_bits (b, last, bit_mask (end - 1) | (bit_mask (end - 1) - 1),
+				value);
+	}
+
+	if (!value && start < b->free_hint)
+		b->free_hint = start;
 }
 
 /* Returns the number of bits in B between START and START + CNT,
    exclusive, that are set to VALUE. */
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i, value_cnt;
+	size_t end = start + cnt;
+	size_t idx, last, true_cnt;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	value_cnt = 0;
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			value_cnt++;
-	return value_cnt;
+	if (cnt == 0)
+		return 0;
+
+	/* Count the true bits a whole element at a time, masking off
+	   the bits outside the range at either end. */
+	idx = elem_idx (start);
+	last = elem_idx (end - 1);
+	true_cnt = 0;
+	for (; idx <= last; idx++) {
+		elem_type word = b->bits[idx];
+
+		if (idx == elem_idx (start))
+			word &= ~(bit_mask (start) - 1);
+		if (idx == last)
+			word &= bit_mask (end - 1) | (bit_mask (end - 1) - 1);
+		true_cnt += popcount (word);
+	}
+	return value ? true_cnt : cnt - true_cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
    exclusive, are set to VALUE, and false otherwise. */
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
-
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			return true;
-	return false;
+	return find_next (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -269,15 +347,42 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt) {
    If there is no such group, returns BITMAP_ERROR. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) {
+	bool from_hint = false;
+
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 
-	if (cnt <= b->bit_cnt) {
-		size_t last = b->bit_cnt - cnt;
-		size_t i;
-		for (i = start; i <= last; i++)
-			if (!bitmap_contains (b, i, cnt, !value))
-				return i;
+	if (cnt > b->bit_cnt)
+		return BITMAP_ERROR;
+	if (cnt == 0)
+		return start;
+
+	/* Every bit below the hint is true, so a scan for false bits
+	   can skip them. */
+	if (!value && start <= b->free_hint) {
+		start = b->free_hint;
+		from_hint = true;
+	}
+
+	/* Jump from run to run of VALUE bits until one is long
+	   enough. */
+	while (start + cnt <= b->bit_cnt) {
+		size_t end;
+
+		start = find_next (b, start, b->bit_cnt, value);
+		if (from_hint) {
+			/* The hint is only a cache, so it is kept up to date
+			   even through a const bitmap. */
+			((struct bitmap *) b)->free_hint = start;
+			from_hint = false;
+		}
+		if (start + cnt > b->bit_cnt)
+			break;
+
+		end = find_next (b, start, start + cnt, !value);
+		if (end == start + cnt)
+			return start;
+		start = end;
 	}
 	return BITMAP_ERROR;
 }
@@ -316,6 +421,7 @@ bitmap_read (struct bitmap *b, struct file *file) {
 		success = file_read_at (file, b->bits, size, 0) == size;
 		b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
 	}
+	b->free_hint = 0;
 	return success;
 }
 
@@ -1,5 +1,15 @@
 #include <string.h>
 #include <debug.h>
+#include <stdint.h>
+
+/* The block functions below move eight bytes at a time with the
+   "rep movsq" and "rep stosq" string instructions, or compare
+   them with plain 64-bit loads, and handle the unaligned head
+   and tail a byte at a time.  The kernel is built with -mno-sse,
+   so wider registers are not an option. */
+
+/* A machine word that may be unaligned and may alias anything. */
+typedef uint64_t word_t __attribute__ ((may_alias, aligned (1)));
 
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
@@ -11,8 +21,19 @@ memcpy (void *dst_, const void *src_, size_t size) {
 	ASSERT (dst != NULL || size == 0);
 	ASSERT (src != NULL || size == 0);
 
-	while (size-- > 0)
-		*dst++ = *src++;
+	if (size >= sizeof (uint64_t)) {
+		/* Bytes up to a word boundary of DST, then whole words. */
+		size_t head = -(uintptr_t) dst % sizeof (uint64_t);
+		size_t cnt_q = (size - head) / sizeof (uint64_t);
+
+		size -= head + cnt_q * sizeof (uint64_t);
+		asm volatile ("rep movsb"
+				: "+D" (dst), "+S" (src), "+c" (head) : : "memory");
+		asm volatile ("rep movsq"
+				: "+D" (dst), "+S" (src), "+c" (cnt_q) : : "memory");
+	}
+	asm volatile ("rep movsb"
+			: "+D" (dst), "+S" (src), "+c" (size) : : "memory");
 
 	return dst_;
 }
@@ -27,17 +48,35 @@ memmove (void *dst_, const void *src_, size_t size) {
 	ASSERT (dst != NULL || size == 0);
 	ASSERT (src != NULL || size == 0);
 
-	if (dst < src) {
-		while (size-- > 0)
-			*dst++ = *src++;
+	if (dst <= src || dst >= src + size) {
+		/* Copying upward is safe: each word is read before the
+		   copy overwrites it. */
+		memcpy (dst, src, size);
 	} else {
-		dst += size;
-		src += size;
-		while (size-- > 0)
-			*--dst = *--src;
+		/* Copy downward with the direction flag set, the tail
+		   bytes first, then whole words.  A single asm statement
+		   sets and clears the flag, so that the compiler never
+		   emits code in between that assumes it is clear.
+		   Interrupt handlers clear the flag on entry and iretq
+		   restores it. */
+		size_t tail = size % sizeof (uint64_t);
+		size_t cnt_q = size / sizeof (uint64_t);
+
+		dst += size - 1;
+		src += size - 1;
+		asm volatile ("std\n\t"
+				"rep movsb\n\t"
+				"sub $7, %%rdi\n\t"
+				"sub $7, %%rsi\n\t"
+				"mov %3, %%rcx\n\t"
+				"rep movsq\n\t"
+				"cld"
+				: "+D" (dst), "+S" (src), "+c" (tail)
+				: "r" (cnt_q)
+				: "memory", "cc");
 	}
 
-	return dst;
+	return dst_;
 }
 
 /* Find the first differing byte in the two blocks of SIZE bytes
@@ -52,6 +91,13 @@ memcmp (const void *a_, const void *b_, size_t size) {
 	ASSERT (a != NULL || size == 0);
 	ASSERT (b != NULL || size == 0);
 
+	/* Skip equal words, then find the differing byte. */
+	for (; size >= sizeof (uint64_t); size -= sizeof (uint64_t)) {
+		if (*(const word_t *) a != *(const word_t *) b)
+			break;
+		a += sizeof (uint64_t);
+		b += sizeof (uint64_t);
+	}
 	for (; size-- > 0; a++, b++)
 		if (*a != *b)
 			return *a > *b ? +1 : -1;
@@ -260,8 +306,21 @@ memset (void *dst_, int value, size_t size) {
 
 	ASSERT (dst != NULL || size == 0);
 
-	while (size-- > 0)
-		*dst++ = value;
+	if (size >= sizeof (uint64_t)) {
+		/* Bytes up to a word boundary, then whole words of VALUE
+		   repeated. */
+		size_t head = -(uintptr_t) dst % sizeof (uint64_t);
+		size_t cnt_q = (size - head) / sizeof (uint64_t);
+		uint64_t word = (unsigned char) value * 0x0101010101010101ULL;
+
+		size -= head + cnt_q * sizeof (uint64_t);
+		asm volatile ("rep stosb"
+				: "+D" (dst), "+c" (head) : "a" (value) : "memory");
+		asm volatile ("rep stosq"
+				: "+D" (dst), "+c" (cnt_q) : "a" (word) : "memory");
+	}
+	asm volatile ("rep stosb"
+			: "+D" (dst), "+c" (size) : "a" (value) : "memory");
 
 	return dst_;
 }
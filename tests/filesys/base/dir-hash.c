@@ -0,0 +1,93 @@
+/* Creates enough files in the root directory for it to become a
+   hash table, removes every other one and creates some of those
+   again, checking at each step which names open() finds and that
+   they are the right files.  The .ck checks the final listing of
+   the directory, as read with readdir by the kernel's "ls". */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 100
+
+/* Size of file I, which tells the first and second file by the
+   same name apart. */
+static size_t
+file_size (int i, bool again) 
+{
+  return again ? 1000 + i : i;
+}
+
+/* Checks that file I opens, as the file of FILE_SIZE (I, AGAIN)
+   bytes, if EXISTS, or that it does not. */
+static void
+check_open (int i, bool exists, bool again) 
+{
+  char name[16];
+  int fd;
+
+  snprintf (name, sizeof name, "file%d", i);
+  fd = open (name);
+  if (!exists)
+    {
+      if (fd >= 0)
+        fail ("open \"%s\" succeeded after remove", name);
+      return;
+    }
+  if (fd < 2)
+    fail ("open \"%s\" failed", name);
+  if (filesize (fd) != (int) file_size (i, again))
+    fail ("\"%s\" has %d bytes, expected %zu", name, filesize (fd),
+          file_size (i, again));
+  close (fd);
+}
+
+void
+test_main (void) 
+{
+  char name[16];
+  int i, pass;
+
+  msg ("create %d files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "file%d", i);
+      if (!create (name, file_size (i, false)))
+        fail ("create \"%s\" failed", name);
+    }
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "file%d", i);
+      if (create (name, 0))
+        fail ("create \"%s\" succeeded twice", name);
+    }
+
+  msg ("remove every other file");
+  for (i = 0; i < FILE_CNT; i += 2)
+    {
+      snprintf (name, sizeof name, "file%d", i);
+      if (!remove (name))
+        fail ("remove \"%s\" failed", name);
+      if (remove (name))
+        fail ("remove \"%s\" succeeded twice", name);
+    }
+
+  /* The second pass finds the names in the kernel's caches. */
+  msg ("open every file twice");
+  for (pass = 0; pass < 2; pass++)
+    for (i = 0; i < FILE_CNT; i++)
+      check_open (i, i % 2 != 0, false);
+
+  msg ("create every fourth file again");
+  for (i = 0; i < FILE_CNT; i += 4)
+    {
+      snprintf (name, sizeof name, "file%d", i);
+      if (!create (name, file_size (i, true)))
+        fail ("create \"%s\" failed", name);
+    }
+
+  msg ("open every file");
+  for (i = 0; i < FILE_CNT; i++)
+    check_open (i, i % 2 != 0 || i % 4 == 0, i % 4 == 0);
+}
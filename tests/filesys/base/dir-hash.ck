@@ -0,0 +1,33 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-hash) begin
+(dir-hash) create 100 files
+(dir-hash) remove every other file
+(dir-hash) open every file twice
+(dir-hash) create every fourth file again
+(dir-hash) open every file
+(dir-hash) end
+EOF
+
+# The kernel's "ls", run after the test, lists the root directory.
+my (@output) = read_text_file ("$test.output");
+my ($start) = grep ($output[$_] eq 'Files in the root directory:',
+		    0...$#output);
+fail "missing directory listing\n" if !defined $start;
+my (@listed);
+for my $line (@output[$start + 1...$#output]) {
+    last if $line eq 'End of listing.';
+    push (@listed, $line);
+}
+
+my (@expected) = ('dir-hash');
+push (@expected, "file$_") foreach grep ($_ % 2 || $_ % 4 == 0, 0...99);
+my ($listed) = join (' ', sort @listed);
+my ($expected) = join (' ', sort @expected);
+fail "root directory lists \"$listed\", expected \"$expected\"\n"
+  if $listed ne $expected;
+pass;
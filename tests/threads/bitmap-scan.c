@@ -0,0 +1,111 @@
+/* Fills a bitmap one bit at a time, the way free_map_allocate()
+   and the swap table do, and then looks for runs of free bits in
+   a fragmented bitmap.  Checks the answers of bitmap_scan()
+   against a bit-at-a-time reference scan, and reports how long
+   each version takes.  The timings only show the speedup; timer
+   ticks are too coarse to fail on. */
+
+#include <bitmap.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/malloc.h"
+#include "devices/timer.h"
+
+#define BIT_CNT 4096
+#define RUN_CNT 8
+
+static size_t ref_scan (const struct bitmap *, size_t cnt);
+
+void
+test_bitmap_scan (void) 
+{
+  struct bitmap *b = bitmap_create (BIT_CNT);
+  int64_t start, fast_ticks, ref_ticks;
+  size_t i, idx;
+
+  if (b == NULL)
+    fail ("out of memory");
+
+  /* Fill with the reference scan. */
+  start = timer_ticks ();
+  for (i = 0; i < BIT_CNT; i++)
+    {
+      idx = ref_scan (b, 1);
+      if (idx != i)
+        fail ("reference scan found bit %zu, expected %zu", idx, i);
+      bitmap_mark (b, idx);
+    }
+  ref_ticks = timer_elapsed (start);
+
+  /* Fill again with bitmap_scan_and_flip(). */
+  bitmap_set_all (b, false);
+  start = timer_ticks ();
+  for (i = 0; i < BIT_CNT; i++)
+    {
+      idx = bitmap_scan_and_flip (b, 0, 1, false);
+      if (idx != i)
+        fail ("bitmap_scan_and_flip found bit %zu, expected %zu", idx, i);
+    }
+  fast_ticks = timer_elapsed (start);
+  if (bitmap_scan (b, 0, 1, false) != BITMAP_ERROR)
+    fail ("full bitmap has a free bit");
+  if (bitmap_count (b, 0, BIT_CNT, true) != BIT_CNT)
+    fail ("full bitmap counts %zu set bits",
+          bitmap_count (b, 0, BIT_CNT, true));
+  msg ("fill: %lld ticks bit at a time, %lld ticks word at a time",
+       ref_ticks, fast_ticks);
+
+  /* Free every other bit, then every other pair of bits, and so
+     on, so only the second half has runs of RUN_CNT free bits. */
+  for (i = 0; i < BIT_CNT / 2; i += 2)
+    bitmap_reset (b, i);
+  for (i = BIT_CNT / 2; i < BIT_CNT; i += 2 * RUN_CNT)
+    bitmap_set_multiple (b, i, RUN_CNT, false);
+  if (bitmap_count (b, 0, BIT_CNT, false) != BIT_CNT / 4 + BIT_CNT / 4)
+    fail ("fragmented bitmap counts %zu free bits",
+          bitmap_count (b, 0, BIT_CNT, false));
+
+  start = timer_ticks ();
+  for (i = 0; i < BIT_CNT / 4 / RUN_CNT; i++)
+    {
+      idx = ref_scan (b, RUN_CNT);
+      if (idx != BIT_CNT / 2 + i * 2 * RUN_CNT)
+        fail ("reference scan found run at %zu", idx);
+      bitmap_set_multiple (b, idx, RUN_CNT, true);
+    }
+  ref_ticks = timer_elapsed (start);
+
+  for (i = BIT_CNT / 2; i < BIT_CNT; i += 2 * RUN_CNT)
+    bitmap_set_multiple (b, i, RUN_CNT, false);
+  start = timer_ticks ();
+  for (i = 0; i < BIT_CNT / 4 / RUN_CNT; i++)
+    {
+      idx = bitmap_scan_and_flip (b, 0, RUN_CNT, false);
+      if (idx != BIT_CNT / 2 + i * 2 * RUN_CNT)
+        fail ("bitmap_scan_and_flip found run at %zu", idx);
+    }
+  fast_ticks = timer_elapsed (start);
+  msg ("runs: %lld ticks bit at a time, %lld ticks word at a time",
+       ref_ticks, fast_ticks);
+
+  bitmap_destroy (b);
+  pass ();
+}
+
+/* Returns the first run of CNT false bits in B, testing one bit
+   at a time from the start like bitmap_scan() used to. */
+static size_t
+ref_scan (const struct bitmap *b, size_t cnt) 
+{
+  size_t i, j;
+
+  for (i = 0; i + cnt <= bitmap_size (b); i++)
+    {
+      for (j = 0; j < cnt; j++)
+        if (bitmap_test (b, i + j))
+          break;
+      if (j == cnt)
+        return i;
+    }
+  return BITMAP_ERROR;
+}
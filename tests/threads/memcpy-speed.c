@@ -0,0 +1,175 @@
+/* Measures memcpy(), memset(), memmove() and memcmp() on a
+   4-page buffer in bytes per 100 cycles, against byte-at-a-time
+   loops like the ones they replaced, and checks their results at
+   every alignment. */
+
+#include <stdio.h>
+#include <string.h>
+#include <intrinsic.h>
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+#define BUF_PAGES 4
+#define BUF_SIZE (BUF_PAGES * PGSIZE)
+#define ITER_CNT 16
+
+static void byte_copy (unsigned char *, const unsigned char *, size_t);
+static void byte_set (unsigned char *, int, size_t);
+static void byte_move_up (unsigned char *, const unsigned char *, size_t);
+static int byte_cmp (const unsigned char *, const unsigned char *, size_t);
+static void check_alignments (unsigned char *, unsigned char *);
+static void report (const char *, uint64_t ref, uint64_t fast);
+
+void
+test_memcpy_speed (void) 
+{
+  unsigned char *src = palloc_get_multiple (PAL_ZERO, BUF_PAGES);
+  unsigned char *dst = palloc_get_multiple (PAL_ZERO, BUF_PAGES);
+  uint64_t start, ref, fast;
+  int i;
+
+  if (src == NULL || dst == NULL)
+    fail ("out of memory");
+  for (i = 0; i < BUF_SIZE; i++)
+    src[i] = i * 7 + 3;
+
+  check_alignments (src, dst);
+
+  start = rdtsc ();
+  for (i = 0; i < ITER_CNT; i++)
+    byte_copy (dst, src, BUF_SIZE);
+  ref = rdtsc () - start;
+  start = rdtsc ();
+  for (i = 0; i < ITER_CNT; i++)
+    memcpy (dst, src, BUF_SIZE);
+  fast = rdtsc () - start;
+  if (memcmp (dst, src, BUF_SIZE))
+    fail ("memcpy of the whole buffer differs");
+  report ("memcpy", ref, fast);
+
+  start = rdtsc ();
+  for (i = 0; i < ITER_CNT; i++)
+    byte_set (dst, 0xcc, BUF_SIZE);
+  ref = rdtsc () - start;
+  start = rdtsc ();
+  for (i = 0; i < ITER_CNT; i++)
+    memset (dst, 0xcc, BUF_SIZE);
+  fast = rdtsc () - start;
+  report ("memset", ref, fast);
+
+  start = rdtsc ();
+  for (i = 0; i < ITER_CNT; i++)
+    byte_move_up (dst + 1, dst, BUF_SIZE - 1);
+  ref = rdtsc () - start;
+  start = rdtsc ();
+  for (i = 0; i < ITER_CNT; i++)
+    memmove (dst + 1, dst, BUF_SIZE - 1);
+  fast = rdtsc () - start;
+  report ("memmove", ref, fast);
+
+  memcpy (dst, src, BUF_SIZE);
+  start = rdtsc ();
+  for (i = 0; i < ITER_CNT; i++)
+    if (byte_cmp (dst, src, BUF_SIZE))
+      fail ("byte compare of equal buffers is nonzero");
+  ref = rdtsc () - start;
+  start = rdtsc ();
+  for (i = 0; i < ITER_CNT; i++)
+    if (memcmp (dst, src, BUF_SIZE))
+      fail ("memcmp of equal buffers is nonzero");
+  fast = rdtsc () - start;
+  report ("memcmp", ref, fast);
+
+  palloc_free_multiple (src, BUF_PAGES);
+  palloc_free_multiple (dst, BUF_PAGES);
+  pass ();
+}
+
+/* Checks short copies, fills and compares at every alignment of
+   source and destination against the byte loops. */
+static void
+check_alignments (unsigned char *src, unsigned char *dst) 
+{
+  unsigned char *ref = dst + BUF_SIZE / 2;
+  size_t s, d, n;
+
+  for (s = 0; s < 8; s++)
+    for (d = 0; d < 8; d++)
+      for (n = 0; n < 40; n++)
+        {
+          byte_set (dst, 0, 64);
+          byte_set (ref, 0, 64);
+          memcpy (dst + d, src + s, n);
+          byte_copy (ref + d, src + s, n);
+          if (memcmp (dst, ref, 64))
+            fail ("memcpy of %zu bytes from +%zu to +%zu differs", n, s, d);
+
+          memset (dst + d, s, n);
+          byte_set (ref + d, s, n);
+          if (memcmp (dst, ref, 64))
+            fail ("memset of %zu bytes at +%zu differs", n, d);
+
+          byte_copy (dst, src, 64);
+          byte_copy (ref, src, 64);
+          memmove (dst + d, dst + s, n);
+          if (d > s)
+            byte_move_up (ref + d, ref + s, n);
+          else
+            byte_copy (ref + d, ref + s, n);
+          if (memcmp (dst, ref, 64))
+            fail ("memmove of %zu bytes from +%zu to +%zu differs", n, s, d);
+
+          if (n > 0)
+            {
+              ref[d + n - 1]++;
+              if (memcmp (dst + d, ref + d, n) >= 0
+                  || memcmp (ref + d, dst + d, n) <= 0)
+                fail ("memcmp of %zu bytes at +%zu has the wrong sign", n, d);
+            }
+        }
+}
+
+/* Prints the throughput of REF and FAST cycles for the whole
+   buffer.  It does not fail on the numbers: cycle counts under an
+   emulator or with preemption are too noisy to judge by. */
+static void
+report (const char *name, uint64_t ref, uint64_t fast) 
+{
+  uint64_t bytes = (uint64_t) BUF_SIZE * ITER_CNT * 100;
+
+  msg ("%s: %llu bytes/100 cycles, byte loop %llu bytes/100 cycles", name,
+       bytes / (fast ? fast : 1), bytes / (ref ? ref : 1));
+}
+
+static void
+byte_copy (unsigned char *dst, const unsigned char *src, size_t size) 
+{
+  while (size-- > 0)
+    *dst++ = *src++;
+}
+
+static void
+byte_set (unsigned char *dst, int value, size_t size) 
+{
+  while (size-- > 0)
+    *dst++ = value;
+}
+
+/* Copies SIZE bytes from SRC to a higher, possibly overlapping,
+   DST, last byte first. */
+static void
+byte_move_up (unsigned char *dst, const unsigned char *src, size_t size) 
+{
+  while (size-- > 0)
+    dst[size] = src[size];
+}
+
+static int
+byte_cmp (const unsigned char *a, const unsigned char *b, size_t size) 
+{
+  for (; size-- > 0; a++, b++)
+    if (*a != *b)
+      return *a > *b ? +1 : -1;
+  return 0;
+}
@@ -36,6 +36,7 @@
 #include "devices/disk.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/page_cache.h"
 #endif
 
 /* Page-map-level-4 with kernel mappings only. */
@@ -86,6 +87,9 @@ main (void) {
 	mem_end = palloc_init ();
 	malloc_init ();
 	paging_init (mem_end);
+#ifdef USERPROG
+	process_cache_init ();
+#endif
 
 #ifdef USERPROG
 	tss_init ();
@@ -226,6 +230,16 @@ parse_options (char **argv) {
 			user_page_limit = atoi (value);
 		else if (!strcmp (name, "-threads-tests"))
 			thread_tests = true;
+#endif
+#ifdef VM
+		else if (!strcmp (name, "-vm-low"))
+			vm_low_watermark = atoi (value);
+		else if (!strcmp (name, "-vm-high"))
+			vm_high_watermark = atoi (value);
+		else if (!strcmp (name, "-vm-policy")) {
+			if (value == NULL || !vm_set_policy (value))
+				PANIC ("unknown page replacement policy `%s'", value);
+		}
 #endif
 		else
 			PANIC ("unknown option `%s' (use -h for help)", name);
@@ -328,6 +342,11 @@ usage (void) {
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+			"  -vm-low=COUNT      Reclaim pages when fewer than COUNT frames are free.\n"
+			"  -vm-high=COUNT     Stop reclaiming once COUNT frames are free.\n"
+			"  -vm-policy=NAME    Use page replacement policy NAME (clock, lru).\n"
 #endif
 			);
 	power_off ();
@@ -354,12 +373,17 @@ static void
 print_stats (void) {
 	timer_print_stats ();
 	thread_print_stats ();
+	palloc_print_stats ();
 #ifdef FILESYS
 	disk_print_stats ();
+	page_cache_print_stats ();
 #endif
 	console_print_stats ();
 	kbd_print_stats ();
 #ifdef USERPROG
 	exception_print_stats ();
 #endif
+#ifdef VM
+	vm_print_stats ();
+#endif
 }
@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -28,17 +29,40 @@
    blocks, we remove all of the arena's blocks from the free list
    and give the arena back to the page allocator.
 
+   In front of each free list sits a "magazine", a small stack
+   of free blocks that is only touched with interrupts off, the
+   per-CPU discipline on our single CPU.  Most requests and frees
+   are served from the magazine without taking the descriptor
+   lock; it is refilled from, and flushed to, the free list
+   MAG_BATCH blocks at a time.  Blocks in a magazine count as in
+   use by their arena.  One entirely unused arena is also kept
+   per descriptor, so that a malloc()/free() pair at the boundary
+   does not get and free a page each time.
+
    We can't handle blocks bigger than 2 kB using this scheme,
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
    the beginning of the allocated block's arena header. */
 
+/* Blocks cached in a magazine, and moved to or from the free
+   list at once. */
+#define MAG_SIZE 16
+#define MAG_BATCH (MAG_SIZE / 2)
+
+/* Free blocks in front of a descriptor's free list. */
+struct magazine {
+	size_t cnt;                 /* Number of blocks in BLOCKS. */
+	struct block *blocks[MAG_SIZE];
+};
+
 /* Descriptor. */
 struct desc {
 	size_t block_size;          /* Size of each element in bytes. */
 	size_t blocks_per_arena;    /* Number of blocks in an arena. */
+	struct magazine mag;        /* Protected by disabling interrupts. */
 	struct list free_list;      /* List of free blocks. */
+	size_t empty_arenas;        /* Arenas with all blocks on FREE_LIST. */
 	struct lock lock;           /* Lock. */
 };
 
@@ -63,6 +87,8 @@ static size_t desc_cnt;         /* Number of descriptors. */
 
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static struct block *block_get (struct desc *);
+static void block_put (struct desc *, struct block *);
 
 /* Initializes the malloc() descriptors. */
 void
@@ -74,7 +100,9 @@ malloc_init (void) {
 		ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
 		d->block_size = block_size;
 		d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
+		d->mag.cnt = 0;
 		list_init (&d->free_list);
+		d->empty_arenas = 0;
 		lock_init (&d->lock);
 	}
 }
@@ -86,6 +114,7 @@ malloc (size_t size) {
 	struct desc *d;
 	struct block *b;
 	struct arena *a;
+	enum intr_level old_level;
 
 	/* A null pointer satisfies a request for 0 bytes. */
 	if (size == 0)
@@ -112,33 +141,33 @@ malloc (size_t size) {
 		return a + 1;
 	}
 
-	lock_acquire (&d->lock);
-
-	/* If the free list is empty, create a new arena. */
-	if (list_empty (&d->free_list)) {
-		size_t i;
-
-		/* Allocate a page. */
-		a = palloc_get_page (0);
-		if (a == NULL) {
-			lock_release (&d->lock);
-			return NULL;
-		}
-
-		/* Initialize arena and add its blocks to the free list. */
-		a->magic = ARENA_MAGIC;
-		a->desc = d;
-		a->free_cnt = d->blocks_per_arena;
-		for (i = 0; i < d->blocks_per_arena; i++) {
-			struct block *b = arena_to_block (a, i);
-			list_push_back (&d->free_list, &b->free_elem);
-		}
+	/* Take a block from the magazine. */
+	old_level = intr_disable ();
+	if (d->mag.cnt > 0) {
+		b = d->mag.blocks[--d->mag.cnt];
+		intr_set_level (old_level);
+		return b;
 	}
+	intr_set_level (old_level);
 
-	/* Get a block from free list and return it. */
-	b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-	a = block_to_arena (b);
-	a->free_cnt--;
+	/* Refill the magazine from the free list. */
+	lock_acquire (&d->lock);
+	b = block_get (d);
+	if (b != NULL) {
+		struct block *batch[MAG_BATCH];
+		size_t cnt = 0;
+
+		while (cnt < MAG_BATCH && (batch[cnt] = block_get (d)) != NULL)
+			cnt++;
+
+		/* Another thread may have filled the magazine meanwhile. */
+		old_level = intr_disable ();
+		while (cnt > 0 && d->mag.cnt < MAG_SIZE)
+			d->mag.blocks[d->mag.cnt++] = batch[--cnt];
+		intr_set_level (old_level);
+		while (cnt > 0)
+			block_put (d, batch[--cnt]);
+	}
 	lock_release (&d->lock);
 	return b;
 }
@@ -204,6 +233,7 @@ free (void *p) {
 		struct block *b = p;
 		struct arena *a = block_to_arena (b);
 		struct desc *d = a->desc;
+		enum intr_level old_level;
 
 		if (d != NULL) {
 			/* It's a normal block.  We handle it here. */
@@ -213,23 +243,26 @@ free (void *p) {
 			memset (b, 0xcc, d->block_size);
 #endif
 
-			lock_acquire (&d->lock);
+			/* Put the block in the magazine if it has room. */
+			old_level = intr_disable ();
+			if (d->mag.cnt < MAG_SIZE) {
+				d->mag.blocks[d->mag.cnt++] = b;
+				intr_set_level (old_level);
+				return;
+			}
 
-			/* Add block to free list. */
-			list_push_front (&d->free_list, &b->free_elem);
+			/* Otherwise flush a batch from it along with B. */
+			struct block *batch[MAG_BATCH];
+			size_t cnt = 0;
 
-			/* If the arena is now entirely unused, free it. */
-			if (++a->free_cnt >= d->blocks_per_arena) {
-				size_t i;
-
-				ASSERT (a->free_cnt == d->blocks_per_arena);
-				for (i = 0; i < d->blocks_per_arena; i++) {
-					struct block *b = arena_to_block (a, i);
-					list_remove (&b->free_elem);
-				}
-				palloc_free_page (a);
-			}
+			while (cnt < MAG_BATCH && d->mag.cnt > 0)
+				batch[cnt++] = d->mag.blocks[--d->mag.cnt];
+			intr_set_level (old_level);
 
+			lock_acquire (&d->lock);
+			block_put (d, b);
+			while (cnt > 0)
+				block_put (d, batch[--cnt]);
 			lock_release (&d->lock);
 		} else {
 			/* It's a big block.  Free its pages. */
@@ -266,3 +299,66 @@ arena_to_block (struct arena *a, size_t idx) {
 			+ sizeof *a
 			+ idx * a->desc->block_size);
 }
+
+/* Takes a block off D's free list, creating a new arena if the
+   list is empty.  Returns a null pointer if memory is not
+   available.  D's lock must be held. */
+static struct block *
+block_get (struct desc *d) {
+	struct block *b;
+	struct arena *a;
+
+	/* If the free list is empty, create a new arena. */
+	if (list_empty (&d->free_list)) {
+		size_t i;
+
+		/* Allocate a page. */
+		a = palloc_get_page (0);
+		if (a == NULL)
+			return NULL;
+
+		/* Initialize arena and add its blocks to the free list. */
+		a->magic = ARENA_MAGIC;
+		a->desc = d;
+		a->free_cnt = d->blocks_per_arena;
+		for (i = 0; i < d->blocks_per_arena; i++) {
+			struct block *b = arena_to_block (a, i);
+			list_push_back (&d->free_list, &b->free_elem);
+		}
+		d->empty_arenas++;
+	}
+
+	/* Get a block from free list. */
+	b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
+	a = block_to_arena (b);
+	if (a->free_cnt-- == d->blocks_per_arena)
+		d->empty_arenas--;
+	return b;
+}
+
+/* Puts block B back on D's free list.  If its arena is now
+   entirely unused, frees the arena, unless it is the only such
+   arena of D.  D's lock must be held. */
+static void
+block_put (struct desc *d, struct block *b) {
+	struct arena *a = block_to_arena (b);
+
+	/* Add block to free list. */
+	list_push_front (&d->free_list, &b->free_elem);
+
+	/* If the arena is now entirely unused, keep it or free it. */
+	if (++a->free_cnt >= d->blocks_per_arena) {
+		size_t i;
+
+		ASSERT (a->free_cnt == d->blocks_per_arena);
+		if (d->empty_arenas == 0) {
+			d->empty_arenas++;
+			return;
+		}
+		for (i = 0; i < d->blocks_per_arena; i++) {
+			struct block *b = arena_to_block (a, i);
+			list_remove (&b->free_elem);
+		}
+		palloc_free_page (a);
+	}
+}
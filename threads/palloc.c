@@ -2,14 +2,15 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
-#include "threads/synch.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -24,13 +25,38 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool is a buddy system.  Its free pages are grouped in
+   blocks of 2**ORDER pages, aligned to their size within the pool,
+   and kept on one free list per order.  A request takes a block of
+   the smallest order that fits, splitting larger ones as needed,
+   and gives back the pages it does not use.  A freed block merges
+   with its buddy, the other half of the block of the next order,
+   for as long as that one is free too.  Both take O(log n) steps
+   however fragmented the pool is.  The used_map bitmap still
+   records which pages are in use.
+
+   palloc_free_page () is called by the scheduler on dying threads
+   with interrupts off, so pools are protected by disabling
+   interrupts rather than by a lock. */
+
+/* Order of pages that do not start a free block. */
+#define NO_ORDER UINT8_MAX
+
+/* Buddy state of a page. */
+struct buddy {
+  struct list_elem elem; /* In the free list of ORDER. */
+  uint8_t order;         /* Order of the free block it starts. */
+};
 
 /* A memory pool. */
 struct pool {
-  struct lock lock;        /* Mutual exclusion. */
-  struct bitmap *used_map; /* Bitmap of free pages. */
-  uint8_t *base;           /* Base of pool. */
+  struct bitmap *used_map;                /* Bitmap of free pages. */
+  struct buddy *pages;                    /* Buddy state of each page. */
+  struct list free_list[PALLOC_ORDERS];   /* Free blocks by order. */
+  size_t free_cnt[PALLOC_ORDERS];         /* Length of each free list. */
+  uint8_t *base;                          /* Base of pool. */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -42,6 +68,10 @@ static void init_pool (struct pool *p, void **bm_base, uint64_t start,
                        uint64_t end);
 
 static bool page_from_pool (const struct pool *, void *page);
+static void init_free_lists (struct pool *);
+static void insert_block (struct pool *, size_t page_idx, size_t order);
+static void remove_block (struct pool *, size_t page_idx);
+static void free_range (struct pool *, size_t page_idx, size_t page_cnt);
 
 /* multiboot info */
 struct multiboot_info {
@@ -250,6 +280,8 @@ palloc_init (void) {
   printf ("\text_mem: 0x%llx ~ 0x%llx (Usable: %'llu kB)\n", ext_mem.start,
           ext_mem.end, ext_mem.size / 1024);
   populate_pools (&base_mem, &ext_mem);
+  init_free_lists (&kernel_pool);
+  init_free_lists (&user_pool);
   return ext_mem.end;
 }
 
@@ -262,16 +294,38 @@ palloc_init (void) {
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  void *pages = NULL;
+  enum intr_level old_level;
+  size_t order, o;
+
+  /* Smallest order that holds PAGE_CNT pages. */
+  for (order = 0; order < PALLOC_ORDERS && ((size_t) 1 << order) < page_cnt;
+       order++)
+    continue;
+
+  old_level = intr_disable ();
+  for (o = order; o < PALLOC_ORDERS && list_empty (&pool->free_list[o]); o++)
+    continue;
+  if (page_cnt > 0 && o < PALLOC_ORDERS) {
+    size_t page_idx =
+        list_entry (list_front (&pool->free_list[o]), struct buddy, elem) -
+        pool->pages;
+
+    remove_block (pool, page_idx);
+
+    /* Split the block down to ORDER, then give back the tail. */
+    while (o > order) {
+      o--;
+      insert_block (pool, page_idx + ((size_t) 1 << o), o);
+    }
+    if (((size_t) 1 << order) > page_cnt)
+      free_range (pool, page_idx + page_cnt, ((size_t) 1 << order) - page_cnt);
 
-  lock_acquire (&pool->lock);
-  size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
-  void *pages;
-
-  if (page_idx != BITMAP_ERROR)
+    ASSERT (bitmap_none (pool->used_map, page_idx, page_cnt));
+    bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
     pages = pool->base + PGSIZE * page_idx;
-  else
-    pages = NULL;
+  }
+  intr_set_level (old_level);
 
   if (pages) {
     if (flags & PAL_ZERO)
@@ -301,6 +355,7 @@ void
 palloc_free_multiple (void *pages, size_t page_cnt) {
   struct pool *pool;
   size_t page_idx;
+  enum intr_level old_level;
 
   ASSERT (pg_ofs (pages) == 0);
   if (pages == NULL || page_cnt == 0)
@@ -318,8 +373,11 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 #ifndef NDEBUG
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
+  old_level = intr_disable ();
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  free_range (pool, page_idx, page_cnt);
+  intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -335,18 +393,132 @@ init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
      Calculate the space needed for the bitmap
      and subtract it from the pool's size. */
   uint64_t pgcnt = (end - start) / PGSIZE;
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (pgcnt), PGSIZE) * PGSIZE;
+  size_t bm_size = ROUND_UP (bitmap_buf_size (pgcnt), sizeof (void *));
+  size_t bm_pages =
+      DIV_ROUND_UP (bm_size + pgcnt * sizeof *p->pages, PGSIZE) * PGSIZE;
+  size_t i;
 
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_pages);
+  p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_size);
+  p->pages = *bm_base + bm_size;
   p->base = (void *) start;
 
   // Mark all to unusable.
   bitmap_set_all (p->used_map, true);
+  for (i = 0; i < pgcnt; i++)
+    p->pages[i].order = NO_ORDER;
+  for (i = 0; i < PALLOC_ORDERS; i++) {
+    list_init (&p->free_list[i]);
+    p->free_cnt[i] = 0;
+  }
 
   *bm_base += bm_pages;
 }
 
+/* Puts the free block of 2**ORDER pages at PAGE_IDX on its free
+   list. */
+static void
+insert_block (struct pool *pool, size_t page_idx, size_t order) {
+  pool->pages[page_idx].order = order;
+  list_push_front (&pool->free_list[order], &pool->pages[page_idx].elem);
+  pool->free_cnt[order]++;
+}
+
+/* Takes the free block at PAGE_IDX off its free list. */
+static void
+remove_block (struct pool *pool, size_t page_idx) {
+  struct buddy *b = &pool->pages[page_idx];
+
+  ASSERT (b->order < PALLOC_ORDERS);
+  list_remove (&b->elem);
+  pool->free_cnt[b->order]--;
+  b->order = NO_ORDER;
+}
+
+/* Frees the block of 2**ORDER pages at PAGE_IDX, merging it with
+   its buddies. */
+static void
+free_block (struct pool *pool, size_t page_idx, size_t order) {
+  size_t page_cnt = bitmap_size (pool->used_map);
+
+  while (order + 1 < PALLOC_ORDERS) {
+    size_t buddy = page_idx ^ ((size_t) 1 << order);
+
+    if (buddy >= page_cnt || pool->pages[buddy].order != order)
+      break;
+    remove_block (pool, buddy);
+    page_idx &= ~((size_t) 1 << order);
+    order++;
+  }
+  insert_block (pool, page_idx, order);
+}
+
+/* Frees the PAGE_CNT pages at PAGE_IDX, in the largest aligned
+   blocks that make them up. */
+static void
+free_range (struct pool *pool, size_t page_idx, size_t page_cnt) {
+  while (page_cnt > 0) {
+    size_t order = 0;
+
+    while (order + 1 < PALLOC_ORDERS &&
+           page_idx % ((size_t) 2 << order) == 0 &&
+           ((size_t) 2 << order) <= page_cnt)
+      order++;
+    free_block (pool, page_idx, order);
+    page_idx += (size_t) 1 << order;
+    page_cnt -= (size_t) 1 << order;
+  }
+}
+
+/* Builds the free lists of POOL from its used_map. */
+static void
+init_free_lists (struct pool *pool) {
+  size_t page_cnt = bitmap_size (pool->used_map);
+  size_t start = 0, end;
+
+  while ((start = bitmap_scan (pool->used_map, start, 1, false)) !=
+         BITMAP_ERROR) {
+    end = bitmap_scan (pool->used_map, start, 1, true);
+    if (end == BITMAP_ERROR)
+      end = page_cnt;
+    free_range (pool, start, end - start);
+    start = end;
+  }
+}
+
+/* Stores the number of free blocks of each order of the user
+   pool, if PAL_USER is set in FLAGS, or of the kernel pool into
+   FREE_CNT. */
+void
+palloc_get_stats (enum palloc_flags flags, size_t free_cnt[PALLOC_ORDERS]) {
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  enum intr_level old_level = intr_disable ();
+
+  memcpy (free_cnt, pool->free_cnt, sizeof pool->free_cnt);
+  intr_set_level (old_level);
+}
+
+/* Prints the free blocks of each pool by order. */
+void
+palloc_print_stats (void) {
+  static const char *names[] = {"kernel", "user"};
+  size_t free_cnt[PALLOC_ORDERS];
+  size_t i, o;
+
+  for (i = 0; i < 2; i++) {
+    size_t pages = 0;
+
+    palloc_get_stats (i ? PAL_USER : 0, free_cnt);
+    for (o = 0; o < PALLOC_ORDERS; o++)
+      pages += free_cnt[o] << o;
+    printf ("Palloc: %s pool %zu free pages, blocks by order:", names[i],
+            pages);
+    for (o = 0; o < PALLOC_ORDERS; o++)
+      if (free_cnt[o] > 0)
+        printf (" %zu:%zu", o, free_cnt[o]);
+    printf ("\n");
+  }
+}
+
 /* Returns true if PAGE was allocated from POOL,
    false otherwise. */
 static bool
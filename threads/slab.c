@@ -0,0 +1,191 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* An object cache, or "slab allocator", for kernel objects that
+   are allocated and freed at a high rate.
+
+   Each cache hands out objects of one size.  They are carved out
+   of slabs of one page each, with the slab header at the start
+   of the page, so objects are packed at their own size instead
+   of malloc()'s next power of 2.
+
+   Every slab keeps a stack of the indexes of its free objects.
+   The constructor of the cache runs once per object, when its
+   slab is created.  Objects must be freed in their constructed
+   state, so allocating one does not initialize it again.
+
+   The cache keeps the slabs that have free objects on a list,
+   and allocation takes the first of them.  One completely free
+   slab is kept around; further ones go back to the page
+   allocator. */
+
+/* Cache. */
+struct kmem_cache {
+	const char *name;           /* For debugging. */
+	size_t obj_size;            /* Size of each object in bytes. */
+	size_t objs_per_slab;       /* Number of objects in a slab. */
+	size_t objs_ofs;            /* Offset of the first object in a slab. */
+	void (*ctor) (void *);      /* Constructor, or null. */
+	struct lock lock;           /* Lock. */
+	struct list partial;        /* Slabs with free objects. */
+	size_t empty_cnt;           /* Slabs in PARTIAL with no object in use. */
+};
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab5eed
+
+/* Slab header. */
+struct slab {
+	unsigned magic;             /* Always set to SLAB_MAGIC. */
+	struct kmem_cache *cache;   /* Owning cache. */
+	struct list_elem elem;      /* In the cache's PARTIAL if FREE_CNT > 0. */
+	size_t free_cnt;            /* Free objects. */
+	uint16_t free[];            /* Indexes of the free objects. */
+};
+
+static void *slab_obj (struct kmem_cache *, struct slab *, size_t idx);
+
+/* Creates and returns a cache of objects of SIZE bytes, or a
+   null pointer if memory is not available.  CTOR, if nonnull, is
+   run on every object before it is first handed out. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, void (*ctor) (void *)) {
+	struct kmem_cache *c = malloc (sizeof *c);
+	size_t n;
+
+	if (c == NULL)
+		return NULL;
+
+	/* Keep the objects aligned for any member. */
+	size = ROUND_UP (size, sizeof (void *));
+	ASSERT (size > 0 && size <= PGSIZE / 2);
+
+	/* As many objects as fit with the header and their indexes. */
+	n = (PGSIZE - sizeof (struct slab)) / (size + sizeof (uint16_t));
+	while (ROUND_UP (sizeof (struct slab) + n * sizeof (uint16_t),
+				sizeof (void *)) + n * size > PGSIZE)
+		n--;
+
+	c->name = name;
+	c->obj_size = size;
+	c->objs_per_slab = n;
+	c->objs_ofs = ROUND_UP (sizeof (struct slab) + n * sizeof (uint16_t),
+			sizeof (void *));
+	c->ctor = ctor;
+	lock_init (&c->lock);
+	list_init (&c->partial);
+	c->empty_cnt = 0;
+	return c;
+}
+
+/* Adds a new slab to cache C.  Returns false if no page is
+   available.  C's lock must be held. */
+static bool
+slab_grow (struct kmem_cache *c) {
+	struct slab *s = palloc_get_page (0);
+	size_t i;
+
+	if (s == NULL)
+		return false;
+
+	s->magic = SLAB_MAGIC;
+	s->cache = c;
+	s->free_cnt = c->objs_per_slab;
+	for (i = 0; i < c->objs_per_slab; i++) {
+		/* Hand out the lowest objects first. */
+		s->free[i] = c->objs_per_slab - 1 - i;
+		if (c->ctor != NULL)
+			c->ctor (slab_obj (c, s, i));
+	}
+
+	list_push_front (&c->partial, &s->elem);
+	c->empty_cnt++;
+	return true;
+}
+
+/* Obtains and returns an object from cache C.
+   Returns a null pointer if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c) {
+	struct slab *s;
+	size_t idx;
+
+	lock_acquire (&c->lock);
+
+	/* If no slab has a free object, create one. */
+	if (list_empty (&c->partial) && !slab_grow (c)) {
+		lock_release (&c->lock);
+		return NULL;
+	}
+
+	s = list_entry (list_front (&c->partial), struct slab, elem);
+	if (s->free_cnt == c->objs_per_slab)
+		c->empty_cnt--;
+	idx = s->free[--s->free_cnt];
+	if (s->free_cnt == 0)
+		list_remove (&s->elem);
+
+	lock_release (&c->lock);
+	return slab_obj (c, s, idx);
+}
+
+/* Frees object P, which must have been allocated from cache C
+   and be back in its constructed state. */
+void
+kmem_cache_free (struct kmem_cache *c, void *p) {
+	struct slab *s;
+	size_t ofs;
+
+	if (p == NULL)
+		return;
+
+	s = pg_round_down (p);
+	ofs = pg_ofs (p) - c->objs_ofs;
+	ASSERT (s->magic == SLAB_MAGIC);
+	ASSERT (s->cache == c);
+	ASSERT (ofs % c->obj_size == 0);
+
+#ifndef NDEBUG
+	/* Clear the object to help detect use-after-free bugs, unless it
+	   has to keep its constructed state. */
+	if (c->ctor == NULL)
+		memset (p, 0xcc, c->obj_size);
+#endif
+
+	lock_acquire (&c->lock);
+
+	/* A full slab has free objects again. */
+	if (s->free_cnt == 0)
+		list_push_front (&c->partial, &s->elem);
+	s->free[s->free_cnt++] = ofs / c->obj_size;
+
+	/* If the slab is now entirely unused, keep it at the back, or
+	   free it if there is such a slab already. */
+	if (s->free_cnt == c->objs_per_slab) {
+		list_remove (&s->elem);
+		if (c->empty_cnt > 0) {
+			s->magic = 0;
+			palloc_free_page (s);
+		} else {
+			list_push_back (&c->partial, &s->elem);
+			c->empty_cnt++;
+		}
+	}
+
+	lock_release (&c->lock);
+}
+
+/* Returns object IDX of slab S in cache C. */
+static void *
+slab_obj (struct kmem_cache *c, struct slab *s, size_t idx) {
+	ASSERT (idx < c->objs_per_slab);
+	return (uint8_t *) s + c->objs_ofs + idx * c->obj_size;
+}
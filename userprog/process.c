@@ -19,6 +19,7 @@
 #include "threads/mmu.h"
 #include "threads/vaddr.h"
 #include "threads/malloc.h"   // malloc() 쓸거야
+#include "threads/slab.h"
 #include "intrinsic.h"
 #include "lib/string.h"
 #include "lib/stdio.h"   // hex_dump() 쓸거야
@@ -38,6 +39,9 @@ static bool load (const char *file_name, struct intr_frame *if_);
 static void initd (void *f_name);
 static void __do_fork (void **);
 
+/* Cache of child_list_elem. */
+static struct kmem_cache *child_cache;
+
 struct child_list_elem *process_set_child_list (struct thread *parent,
                                                 struct thread *child);
 
@@ -255,9 +259,19 @@ error:
   thread_exit ();
 }
 
+/* Creates the cache of child_list_elem, before the first thread_create (). */
+void
+process_cache_init (void) {
+  child_cache =
+      kmem_cache_create ("child_list_elem", sizeof (struct child_list_elem),
+                         NULL);
+  if (child_cache == NULL)
+    PANIC ("process_cache_init() out of memory");
+}
+
 struct child_list_elem *
 process_set_child_list (struct thread *parent, struct thread *child) {
-  struct child_list_elem *child_elem = malloc (sizeof (struct child_list_elem));
+  struct child_list_elem *child_elem = kmem_cache_alloc (child_cache);
   child_elem->child_status = child->status;
   child_elem->child_tid = child->tid;
   child_elem->child_exit_status = 0;
@@ -334,7 +348,7 @@ process_wait (tid_t child_tid) {
         }
         return_val = target->child_exit_status;
         list_remove (cur);
-        free (target);
+        kmem_cache_free (child_cache, target);
         return return_val;
       }
       cur = list_next (cur);
@@ -381,7 +395,7 @@ process_exit (void) {
     if (tgt->child_status != THREAD_DYING) {
       tgt->child->my_info = NULL;
     }
-    free (tgt);
+    kmem_cache_free (child_cache, tgt);
   }
   intr_set_level (old_level);
 
@@ -834,35 +848,6 @@ install_page (void *upage, void *kpage, bool writable) {
  * If you want to implement the function for only project 2, implement it on the
  * upper block. */
 
-static bool
-lazy_load_segment (struct page *page, void *aux) {
-  struct load_seg_args *args = aux;
-  struct file *file = args->file;
-  off_t ofs = args->ofs;
-  size_t page_read_bytes = args->page_read_bytes;
-  size_t page_zero_bytes = args->page_zero_bytes;
-  bool has_lock = false;
-
-  if (lock_held_by_current_thread (&file_lock))
-    has_lock = true;
-
-  file_seek (file, ofs);
-  if (!has_lock)
-    lock_acquire (&file_lock);
-  if (file_read (file, page->frame->kva, page_read_bytes) !=
-      (int) page_read_bytes) {
-    if (!has_lock)
-      lock_release (&file_lock);
-    return false;
-  }
-  if (!has_lock)
-    lock_release (&file_lock);
-  ASSERT (page->frame->kva != NULL);
-  memset (page->frame->kva + page_read_bytes, 0, page_zero_bytes);
-
-  return true;
-}
-
 /* Loads a segment starting at offset OFS in FILE at address
  * UPAGE.  In total, READ_BYTES + ZERO_BYTES bytes of virtual
  * memory are initialized, as follows:
@@ -884,36 +869,10 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage, uint32_t read_bytes,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
-  while (read_bytes > 0 || zero_bytes > 0) {
-    /* Do calculate how to fill this page.
-     * We will read PAGE_READ_BYTES bytes from FILE
-     * and zero the final PAGE_ZERO_BYTES bytes. */
-    size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-    size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-    struct load_seg_args *aux = malloc (sizeof (struct load_seg_args));
-
-    // clang-format off
-    *aux = (struct load_seg_args){
-      .file = file,
-      .ofs = ofs,
-      .page_read_bytes = page_read_bytes,
-      .page_zero_bytes = page_zero_bytes
-      };
-    // clang-format on
-
-    if (!vm_alloc_page_with_initializer (VM_ANON, upage, writable,
-                                         lazy_load_segment, aux)) {
-      return false;
-    }
-
-    /* Advance. */
-    read_bytes -= page_read_bytes;
-    zero_bytes -= page_zero_bytes;
-    ofs += PGSIZE;
-    upage += PGSIZE;
-  }
-  return true;
+  /* The pages are created from the area on their first fault. */
+  return vm_area_create (&thread_current ()->spt, upage,
+                         read_bytes + zero_bytes, VM_ANON, writable, file, ofs,
+                         read_bytes) != NULL;
 }
 
 /* Create a PAGE of stack at the USER_STACK. Return true on success. */
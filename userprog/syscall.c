@@ -46,6 +46,7 @@ void syscall_handler (struct intr_frame *);
 #define F_ARG6 f->R.r9
 
 bool address_check (char *ptr);
+static bool buffer_writable (void *buffer, unsigned size);
 
 int fd_table_get_fd (struct file *_file);
 struct file *fd_table_get_file (int fd);
@@ -221,7 +222,7 @@ read_handler (struct intr_frame *f) {
     kern_exit (f, -1);
   if (!address_check (buffer))
     kern_exit (f, -1);
-  if (!spt_find_page (&thread_current ()->spt, buffer)->writable)
+  if (!buffer_writable (buffer, size))
     kern_exit (f, -1);
 
   struct file *file_ = fd_table_get_file (fd);
@@ -340,13 +341,8 @@ mmap_handler (struct intr_frame *f) {
   }
   // clang-format on
 
-  struct file *old_file = fd_table_get_file (fd);
-  if (old_file == NULL) {
-    success = false;
-    goto result;
-  }
-
-  struct file *file = file_reopen (old_file);
+  /* The mapping keeps a reference of its own to the file. */
+  struct file *file = fd_table_get_file (fd);
   if (file == NULL) {
     success = false;
     goto result;
@@ -400,12 +396,31 @@ address_check (char *ptr) {
   if (is_kernel_vaddr (ptr))
     return false;
 
-  if (spt_find_page (&curr->spt, ptr) == NULL)
+  if (vm_area_find (&curr->spt, ptr) == NULL)
     return false;
 
   return true;
 }
 
+/* Whether [BUFFER, BUFFER + SIZE) lies in writable areas only. The
+ * kernel writes to user pages with CR0.WP set, so a store into a
+ * read-only page would fault in the kernel. */
+static bool
+buffer_writable (void *buffer, unsigned size) {
+  struct supplemental_page_table *spt = &thread_current ()->spt;
+  void *end = buffer + size;
+  void *va = buffer;
+
+  do {
+    struct vm_area *area = vm_area_find (spt, va);
+
+    if (area == NULL || !area->writable)
+      return false;
+    va = area->end;
+  } while (va < end);
+  return true;
+}
+
 void
 kern_exit (struct intr_frame *f, int status) {
   F_ARG1 = status;
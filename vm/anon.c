@@ -1,9 +1,12 @@
 /* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
 
 #include "vm/vm.h"
+#include "vm/swap.h"
 #include "devices/disk.h"
 #include "threads/synch.h"
 #include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "intrinsic.h"
 #include <bitmap.h>
 #include <string.h>
 
@@ -23,11 +26,32 @@ static const struct page_operations anon_ops = {
 
 struct swap_table {
   struct bitmap *used_map; /* Bitmap of free swap slots. */
+  size_t used_cnt;         /* Number of slots in use. */
   struct lock lock;        /* Mutual exclusion. */
 };
 
 static struct swap_table swap_tbl;
 
+/* Swap readahead cache.
+ * A swap-in reads the whole SWAP_CLUSTER-aligned window of slots around the
+ * faulting one, so that pages evicted together come back with one transfer.
+ * VALID has a bit per slot of the window still matching the disk. GEN is
+ * bumped whenever a write starts or ends; a readahead is only installed if
+ * no write overlapped it. */
+struct swap_cache {
+  struct lock lock; /* Protects all members. */
+  void *buf;        /* SWAP_CLUSTER pages, or NULL. */
+  size_t base;      /* First slot held in BUF. */
+  unsigned valid;   /* Bit I set: BUF holds slot BASE + I. */
+  unsigned gen;     /* Write generation. */
+  int writers;      /* Swap writes in flight. */
+};
+
+static struct swap_cache swap_cache;
+
+static void swap_cache_write_begin (size_t slot, size_t cnt);
+static void swap_cache_write_end (void);
+
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
@@ -43,7 +67,13 @@ vm_anon_init (void) {
   ASSERT (swap_size == bitmap_size (bitmap_block));
   ASSERT (res == bitmap_block);
   swap_tbl.used_map = res;
+  swap_tbl.used_cnt = 0;
   lock_init (&swap_tbl.lock);
+
+  lock_init (&swap_cache.lock);
+  swap_cache.buf = NULL;
+
+  swap_io_init (swap_disk);
 }
 
 /* Initialize the file mapping */
@@ -56,8 +86,9 @@ anon_initializer (struct page *page, enum vm_type type, void *kva) {
   struct anon_page *anon_page = &page->anon;
   anon_page->init = page->uninit.init;
   anon_page->aux = page->uninit.aux;
-  anon_page->swap_slot = -1;
+  anon_page->swap_slot = SWAP_SLOT_NONE;
   anon_page->is_swapped_out = false;
+  anon_page->clean_init = true;
 
   // ! 별도의 initializer를 실행하고 싶지않다면 false를 리턴하자
   // ! RAX에 뭐든 들어갈 것이기 때문에 웬만하면 true 리턴함...
@@ -65,47 +96,254 @@ anon_initializer (struct page *page, enum vm_type type, void *kva) {
   return true;
 }
 
-/* Swap in the page by read contents from the swap disk. */
+/* Allocate CNT consecutive swap slots. Returns the first one, or
+ * BITMAP_ERROR. */
+static size_t
+swap_slot_alloc (size_t cnt) {
+  size_t slot;
+
+  lock_acquire (&swap_tbl.lock);
+  slot = bitmap_scan_and_flip (swap_tbl.used_map, 0, cnt, false);
+  if (slot != BITMAP_ERROR)
+    swap_tbl.used_cnt += cnt;
+  lock_release (&swap_tbl.lock);
+
+  return slot;
+}
+
+static void
+swap_slot_free (size_t slot) {
+  lock_acquire (&swap_tbl.lock);
+  bitmap_reset (swap_tbl.used_map, slot);
+  swap_tbl.used_cnt--;
+  lock_release (&swap_tbl.lock);
+}
+
+/* Copy SLOT from the readahead cache into KVA. Returns false on a miss. */
+static bool
+swap_cache_lookup (size_t slot, void *kva) {
+  bool hit = false;
+
+  lock_acquire (&swap_cache.lock);
+  if (swap_cache.buf != NULL && slot >= swap_cache.base &&
+      slot < swap_cache.base + SWAP_CLUSTER &&
+      (swap_cache.valid & (1u << (slot - swap_cache.base)))) {
+    memcpy (kva, swap_cache.buf + (slot - swap_cache.base) * PGSIZE, PGSIZE);
+    /* The page stays resident until its next eviction, which rewrites the
+     * slot or leaves it as is. Either way this copy won't be asked again. */
+    swap_cache.valid &= ~(1u << (slot - swap_cache.base));
+    hit = true;
+  }
+  lock_release (&swap_cache.lock);
+
+  return hit;
+}
+
+/* Read the cluster around SLOT into a fresh buffer, copy SLOT into KVA and
+ * keep the neighbours as readahead. Returns false if no readahead was
+ * possible, in which case nothing has been read. */
+static bool
+swap_cache_readahead (size_t slot, void *kva) {
+  size_t base = slot - slot % SWAP_CLUSTER;
+  size_t cnt = bitmap_size (swap_tbl.used_map) - base;
+  struct swap_io io;
+  void *old_buf = NULL;
+  unsigned gen, valid = 0;
+  bool busy;
+
+  if (cnt > SWAP_CLUSTER)
+    cnt = SWAP_CLUSTER;
+
+  lock_acquire (&swap_cache.lock);
+  gen = swap_cache.gen;
+  busy = swap_cache.writers > 0;
+  lock_release (&swap_cache.lock);
+  if (busy || cnt == 1)
+    return false;
+
+  io = (struct swap_io){.write = false, .slot = base, .cnt = cnt};
+  io.buf = palloc_get_multiple (0, SWAP_CLUSTER);
+  if (io.buf == NULL)
+    return false;
+
+  swap_io_submit (&io);
+  swap_io_wait (&io);
+  memcpy (kva, io.buf + (slot - base) * PGSIZE, PGSIZE);
+
+  for (size_t i = 0; i < cnt; i++)
+    if (base + i != slot && bitmap_test (swap_tbl.used_map, base + i))
+      valid |= 1u << i;
+
+  lock_acquire (&swap_cache.lock);
+  if (swap_cache.gen == gen) {
+    old_buf = swap_cache.buf;
+    swap_cache.buf = io.buf;
+    swap_cache.base = base;
+    swap_cache.valid = valid;
+  } else
+    old_buf = io.buf;
+  lock_release (&swap_cache.lock);
+
+  palloc_free_multiple (old_buf, SWAP_CLUSTER);
+  return true;
+}
+
+/* Note that CNT slots from SLOT are about to be overwritten. */
+static void
+swap_cache_write_begin (size_t slot, size_t cnt) {
+  lock_acquire (&swap_cache.lock);
+  for (size_t i = slot; i < slot + cnt; i++)
+    if (i >= swap_cache.base && i < swap_cache.base + SWAP_CLUSTER)
+      swap_cache.valid &= ~(1u << (i - swap_cache.base));
+  swap_cache.writers++;
+  swap_cache.gen++;
+  lock_release (&swap_cache.lock);
+}
+
+static void
+swap_cache_write_end (void) {
+  lock_acquire (&swap_cache.lock);
+  swap_cache.writers--;
+  swap_cache.gen++;
+  lock_release (&swap_cache.lock);
+}
+
+/* Swap in the page by read contents from the swap disk.
+ * Only the slot bookkeeping runs under the swap table lock; the read itself
+ * is queued to the swap I/O worker and we wait for our page only.
+ * A page dropped while it still matched what INIT loads is loaded again by
+ * INIT instead. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
   struct anon_page *anon_page = &page->anon;
-  lock_acquire (&swap_tbl.lock);
-  // todo: exception 처리하기
-  char buf[512];
   size_t swap_slot = anon_page->swap_slot;
+  bool swap_full;
 
-  for (int i = 0; i < 8; i++) {
-    disk_read (swap_disk, swap_slot * 8 + i, buf);
-    memcpy (kva + i * 512, buf, 512);
+  if (swap_slot == SWAP_SLOT_NONE) {
+    ASSERT (anon_page->clean_init);
+    anon_page->is_swapped_out = false;
+    if (anon_page->init == NULL) {
+      zero_page (kva);
+      return true;
+    }
+    return anon_page->init (page, anon_page->aux);
   }
 
-  bitmap_reset (swap_tbl.used_map, swap_slot);
-  anon_page->is_swapped_out = false;
+  if (!swap_cache_lookup (swap_slot, kva) &&
+      !swap_cache_readahead (swap_slot, kva))
+    swap_io_read (swap_slot, kva);
 
+  /* Keep the slot, so that evicting the page again before it is modified
+   * costs no write. Once swap is half full, slots go to pages that need
+   * them. */
+  lock_acquire (&swap_tbl.lock);
+  swap_full = swap_tbl.used_cnt > bitmap_size (swap_tbl.used_map) / 2;
   lock_release (&swap_tbl.lock);
+  if (swap_full) {
+    swap_slot_free (swap_slot);
+    anon_page->swap_slot = SWAP_SLOT_NONE;
+  }
+
+  anon_page->is_swapped_out = false;
 
   return true;
 }
 
-/* Swap out the page by writing contents to the swap disk. */
+/* Whether PAGE can be evicted without writing it: it has not been modified
+ * since it was last read from swap, or since INIT or zeroing filled it. */
+bool
+anon_is_clean (struct page *page) {
+  struct anon_page *anon_page = &page->anon;
+
+  return !frame_is_dirty (page->frame) &&
+         (anon_page->swap_slot != SWAP_SLOT_NONE || anon_page->clean_init);
+}
+
+/* Swap out the page by writing contents to the swap disk. A clean page is
+ * only unmapped, a dirty one rewrites the slot it already has, if any. */
 static bool
 anon_swap_out (struct page *page) {
   struct anon_page *anon_page = &page->anon;
-  lock_acquire (&swap_tbl.lock);
-  // todo: exception 처리하기
-  size_t swap_slot = bitmap_scan_and_flip (swap_tbl.used_map, 0, 1, false);
-  void *va = page->va;
+  size_t swap_slot = anon_page->swap_slot;
+  bool dirty;
 
-  for (int i = 0; i < 8; i++)
-    disk_write (swap_disk, swap_slot * 8 + i, va + 512 * i);
+  /* Unmap first, so that the owner cannot modify the page under the write
+   * and a racing write still shows up in the dirty bit. */
+  pml4_clear_page (page->pml4, page->va);
+  dirty = frame_is_dirty (page->frame);
+  if (dirty)
+    anon_page->clean_init = false;
+  else if (swap_slot != SWAP_SLOT_NONE || anon_page->clean_init) {
+    anon_page->is_swapped_out = true;
+    return true;
+  }
+
+  if (swap_slot == SWAP_SLOT_NONE) {
+    swap_slot = swap_slot_alloc (1);
+    if (swap_slot == BITMAP_ERROR) {
+      pml4_set_page (page->pml4, page->va, page->frame->kva, page->writable);
+      pml4_set_dirty (page->pml4, page->va, dirty);
+      return false;
+    }
+  }
+
+  swap_cache_write_begin (swap_slot, 1);
+  swap_io_write (swap_slot, page->frame->kva);
+  swap_cache_write_end ();
 
   anon_page->swap_slot = swap_slot;
   anon_page->is_swapped_out = true;
 
-  page->frame = NULL;
-  pml4_clear_page (page->pml4, page->va);
+  return true;
+}
 
-  lock_release (&swap_tbl.lock);
+/* Swap out the CNT anonymous PAGES with a single sequential write.
+ * They get consecutive slots and are gathered into a bounce buffer, so that
+ * one transfer replaces CNT scattered ones and a later swap-in of any of
+ * them reads the others back as readahead.
+ * Returns false, without touching any page, if there is no run of CNT free
+ * slots or no memory for the bounce buffer. */
+bool
+anon_swap_out_cluster (struct page *pages[], size_t cnt) {
+  struct swap_io io;
+  size_t first;
+
+  ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER);
+
+  io = (struct swap_io){.write = true, .cnt = cnt};
+  io.buf = palloc_get_multiple (0, cnt);
+  if (io.buf == NULL)
+    return false;
+
+  first = swap_slot_alloc (cnt);
+  if (first == BITMAP_ERROR) {
+    palloc_free_multiple (io.buf, cnt);
+    return false;
+  }
+
+  for (size_t i = 0; i < cnt; i++) {
+    pml4_clear_page (pages[i]->pml4, pages[i]->va);
+    memcpy (io.buf + i * PGSIZE, pages[i]->frame->kva, PGSIZE);
+  }
+
+  io.slot = first;
+  swap_cache_write_begin (first, cnt);
+  swap_io_submit (&io);
+  swap_io_wait (&io);
+  swap_cache_write_end ();
+  palloc_free_multiple (io.buf, cnt);
+
+  /* Stale copies are dropped rather than rewritten in place, so that the
+   * cluster stays one sequential write. */
+  for (size_t i = 0; i < cnt; i++) {
+    struct anon_page *anon_page = &pages[i]->anon;
+
+    if (anon_page->swap_slot != SWAP_SLOT_NONE)
+      swap_slot_free (anon_page->swap_slot);
+    anon_page->swap_slot = first + i;
+    anon_page->is_swapped_out = true;
+    anon_page->clean_init = false;
+  }
 
   return true;
 }
@@ -114,11 +352,10 @@ anon_swap_out (struct page *page) {
 static void
 anon_destroy (struct page *page) {
   struct anon_page *anon_page = &page->anon;
-  void *aux = anon_page->aux;
-  struct frame *frame_p = page->frame;
 
-  if (frame_p != NULL)
-    free (frame_p);
-  if (aux != NULL)
-    free (aux);
+  /* Waits for an eviction writing the page out, which may pick its slot. */
+  vm_release_frame (page);
+
+  if (anon_page->swap_slot != SWAP_SLOT_NONE)
+    swap_slot_free (anon_page->swap_slot);
 }
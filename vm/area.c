@@ -0,0 +1,217 @@
+/* area.c: Regions of the user address space.
+ *
+ * load () and mmap () describe whole regions instead of allocating a page,
+ * with its own load arguments, for every page they cover. The struct page of
+ * an address is created from its area on the first fault, so untouched parts
+ * of a mapping cost nothing. munmap, fork and exit work area by area. */
+
+#include "vm/area.h"
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/syscall.h"
+
+static bool vm_area_load (struct page *page, void *aux);
+
+/* Cache of struct vm_area. */
+static struct kmem_cache *area_cache;
+
+void
+vm_area_init (void) {
+  area_cache = kmem_cache_create ("vm_area", sizeof (struct vm_area), NULL);
+  if (area_cache == NULL)
+    PANIC ("vm_area_init() out of memory");
+}
+
+/* Create an area of SIZE bytes at START, in pages of TYPE. The first
+ * READ_BYTES bytes come from FILE at OFS, the rest reads zeros. FILE may be
+ * NULL for zero-filled memory, the area keeps a reference of its own.
+ * Returns NULL if the range overlaps another area or memory runs out. */
+struct vm_area *
+vm_area_create (struct supplemental_page_table *spt, void *start, size_t size,
+                enum vm_type type, bool writable, struct file *file, off_t ofs,
+                size_t read_bytes) {
+  void *end = pg_round_up (start + size);
+  struct vm_area *next = vm_area_next (spt, start);
+  struct vm_area *area;
+  bool has_lock;
+
+  ASSERT (pg_ofs (start) == 0);
+
+  if (size == 0 || end <= start || !is_user_vaddr (end - 1) ||
+      (next != NULL && next->start < end))
+    return NULL;
+
+  // !!! MALLOC !!!
+  area = kmem_cache_alloc (area_cache);
+  if (area == NULL)
+    return NULL;
+
+  // clang-format off
+  *area = (struct vm_area) {
+    .start = start,
+    .end = end,
+    .type = type,
+    .writable = writable,
+    .ofs = ofs,
+    .read_bytes = read_bytes,
+  };
+  // clang-format on
+
+  if (file != NULL) {
+    has_lock = lock_held_by_current_thread (&file_lock);
+    if (!has_lock)
+      lock_acquire (&file_lock);
+    area->file = file_reopen (file);
+    if (!has_lock)
+      lock_release (&file_lock);
+    if (area->file == NULL) {
+      kmem_cache_free (area_cache, area);
+      return NULL;
+    }
+  }
+
+  if (next != NULL)
+    list_insert (&next->elem, &area->elem);
+  else
+    list_push_back (&spt->areas, &area->elem);
+  return area;
+}
+
+/* Remove every page of AREA, writing back mapped files, and free it. */
+void
+vm_area_destroy (struct supplemental_page_table *spt, struct vm_area *area) {
+  struct page *page = spt_next_page (spt, area->start);
+  bool has_lock;
+
+  while (page != NULL && page->va < area->end) {
+    void *next = page->va + PGSIZE;
+
+    spt_remove_page (spt, page);
+    page = spt_next_page (spt, next);
+  }
+
+  if (area->file != NULL) {
+    has_lock = lock_held_by_current_thread (&file_lock);
+    if (!has_lock)
+      lock_acquire (&file_lock);
+    file_close (area->file);
+    if (!has_lock)
+      lock_release (&file_lock);
+  }
+
+  list_remove (&area->elem);
+  kmem_cache_free (area_cache, area);
+}
+
+/* Copy the areas of SRC into DST, which has none. The pages are not
+ * copied. */
+bool
+vm_area_copy (struct supplemental_page_table *dst,
+              struct supplemental_page_table *src) {
+  struct list_elem *e;
+
+  for (e = list_begin (&src->areas); e != list_end (&src->areas);
+       e = list_next (e)) {
+    struct vm_area *a = list_entry (e, struct vm_area, elem);
+
+    if (vm_area_create (dst, a->start, a->end - a->start, a->type,
+                        a->writable, a->file, a->ofs, a->read_bytes) == NULL)
+      return false;
+  }
+  return true;
+}
+
+/* The first area of SPT that ends above VA, or NULL. */
+struct vm_area *
+vm_area_next (struct supplemental_page_table *spt, const void *va) {
+  struct list_elem *e;
+
+  for (e = list_begin (&spt->areas); e != list_end (&spt->areas);
+       e = list_next (e)) {
+    struct vm_area *area = list_entry (e, struct vm_area, elem);
+
+    if (va < area->end)
+      return area;
+  }
+  return NULL;
+}
+
+/* The area of SPT containing VA, or NULL. */
+struct vm_area *
+vm_area_find (struct supplemental_page_table *spt, const void *va) {
+  struct vm_area *area = vm_area_next (spt, va);
+
+  return area != NULL && area->start <= va ? area : NULL;
+}
+
+/* Return the page at VA, creating it from its area on first use. Returns
+ * NULL if VA belongs to no area. */
+struct page *
+vm_area_page (struct supplemental_page_table *spt, void *va) {
+  struct page *page = spt_find_page (spt, va);
+  struct vm_area *area;
+
+  if (page != NULL)
+    return page;
+
+  area = vm_area_find (spt, va);
+  if (area == NULL ||
+      !vm_alloc_page_with_initializer (area->type, pg_round_down (va),
+                                       area->writable,
+                                       area->file ? vm_area_load : NULL, area))
+    return NULL;
+  return spt_find_page (spt, va);
+}
+
+/* Offset in the area's file of the page at VA. */
+off_t
+vm_area_page_ofs (const struct vm_area *area, const void *va) {
+  return area->ofs + (pg_round_down (va) - area->start);
+}
+
+/* Bytes of the page at VA read from the area's file. */
+size_t
+vm_area_page_read_bytes (const struct vm_area *area, const void *va) {
+  size_t skip = pg_round_down (va) - area->start;
+
+  if (area->file == NULL || skip >= area->read_bytes)
+    return 0;
+  return area->read_bytes - skip < PGSIZE ? area->read_bytes - skip : PGSIZE;
+}
+
+/* Fill KVA with the contents of the page at VA. Bytes past the end of the
+ * file read as zeros in a file mapping, but fail an executable segment. */
+bool
+vm_area_read (struct vm_area *area, const void *va, void *kva) {
+  size_t read_bytes = vm_area_page_read_bytes (area, va);
+  size_t prefetched = pg_round_down (va) - area->prefetch_va;
+  bool has_lock;
+  off_t res = 0;
+
+  if (area->prefetch != NULL && pg_round_down (va) >= area->prefetch_va &&
+      prefetched < area->prefetch_cnt * PGSIZE) {
+    memcpy (kva, area->prefetch + prefetched, read_bytes);
+    res = read_bytes;
+  } else if (read_bytes > 0) {
+    has_lock = lock_held_by_current_thread (&file_lock);
+    if (!has_lock)
+      lock_acquire (&file_lock);
+    res = file_read_at (area->file, kva, read_bytes,
+                        vm_area_page_ofs (area, va));
+    if (!has_lock)
+      lock_release (&file_lock);
+  }
+  memset (kva + res, 0, PGSIZE - res);
+
+  return res == (off_t) read_bytes || VM_TYPE (area->type) == VM_FILE;
+}
+
+/* Initializer of the pages of file-backed areas. */
+static bool
+vm_area_load (struct page *page, void *aux) {
+  return vm_area_read (aux, page->va, page->frame->kva);
+}
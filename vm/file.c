@@ -7,6 +7,7 @@
 #include "userprog/syscall.h"
 
 #include <round.h>
+#include <string.h>
 
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
@@ -35,123 +36,102 @@ file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
 
   file_page->init = page->uninit.init;
   file_page->aux = page->uninit.aux;
+
+  return true;
 }
 
 /* Swap in the page by read contents from the file. */
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
-  struct file_page *file_page UNUSED = &page->file;
-  printf ("FILE SWAP IN!\n");
+  return vm_area_read (page->file.aux, page->va, kva);
 }
 
-/* Swap out the page by writeback contents to the file. */
-static bool
-file_backed_swap_out (struct page *page) {
-  struct file_page *file_page = &page->file;
-  struct list *mapped_pages = &thread_current ()->spt.mapped_pages;
-
-  // printf ("============ Before Traverse ============\n");
-  // for (struct list_elem *cur = list_begin (mapped_pages);
-  //      cur != list_end (mapped_pages); cur = list_next (cur)) {
+/* Write the contents of PAGE, resident in FRAME, back to its file. */
+static void
+file_backed_write (struct page *page, struct frame *frame) {
+  struct vm_area *area = page->file.aux;
 
-  //   struct page *f = list_entry (cur, struct page, mmap_elem);
-  //   printf ("%d\n", f->mmap_length);
-  // }
+  file_write_at (area->file, frame->kva,
+                 vm_area_page_read_bytes (area, page->va),
+                 vm_area_page_ofs (area, page->va));
+}
 
-  // printf ("<1> is dirty: %d\n", pml4_is_dirty (page->pml4, page->va));
-  // pml4_set_dirty (page->pml4, page->va, true);
-  // printf ("<2> is dirty: %d\n", pml4_is_dirty (page->pml4, page->va));
-  // do_munmap (page->va);
+/* Swap out the page by writeback contents to the file.
+ * A clean page is just dropped, it is read back from the file on the next
+ * fault. A dirty one is written back once and then counts as clean. */
+static bool
+file_backed_swap_out (struct page *page) {
+  bool has_lock = lock_held_by_current_thread (&file_lock);
+
+  /* Unmap first, so that a racing write still shows up in the dirty bit. */
+  pml4_clear_page (page->pml4, page->va);
+  if (!frame_is_dirty (page->frame))
+    return true;
+
+  /* A thread holding file_lock may be faulting on PAGE, waiting for this
+   * eviction to end: never wait for file_lock here. */
+  if (!has_lock && !lock_try_acquire (&file_lock)) {
+    pml4_set_page (page->pml4, page->va, page->frame->kva, page->writable);
+    pml4_set_dirty (page->pml4, page->va, true);
+    return false;
+  }
+  file_backed_write (page, page->frame);
+  if (!has_lock)
+    lock_release (&file_lock);
 
-  // page->frame = NULL;
-  // pml4_clear_page (page->pml4, page->va);
-  // todo: exception 처리하기
-  // printf ("FILE SWAP OUT!\n");
+  /* The write-back on destroy must not write it again. */
+  pml4_set_dirty (page->pml4, page->va, false);
+  page->frame->dirty = false;
   return true;
 }
 
-/* Destory the file backed page. PAGE will be freed by the caller. */
+/* Destory the file backed page, writing it back if it was modified. PAGE
+ * will be freed by the caller. */
 static void
 file_backed_destroy (struct page *page) {
-  struct file_page *file_page = &page->file;
-  void *aux = file_page->aux;
-  struct frame *frame_p = page->frame;
-
-  if (frame_p != NULL)
-    free (frame_p);
-  if (aux != NULL)
-    free (aux);
-}
-
-static bool
-mmap_lazy_load (struct page *page, void *aux) {
-  struct list *mapped_pages = &thread_current ()->spt.mapped_pages;
-  struct load_seg_args *args = aux;
-  struct file *file = args->file;
-  off_t ofs = args->ofs;
-  size_t page_read_bytes = args->page_read_bytes;
-  size_t page_zero_bytes = args->page_zero_bytes;
-  size_t read_bytes = args->read_bytes;
-  bool has_lock = false;
-
-  file_seek (file, ofs);
-
-  lock_acquire (&file_lock);
-  off_t res = file_read (file, page->frame->kva, page_read_bytes);
-  page->mmap_length = read_bytes;
-  lock_release (&file_lock);
-  memset (page->frame->kva + page_read_bytes, 0, page_zero_bytes);
-  list_push_back (mapped_pages, &page->mmap_elem);
+  struct frame *frame = frame_pin_page (page);
+  bool has_lock;
+
+  if (frame != NULL && frame_is_dirty (frame)) {
+    has_lock = lock_held_by_current_thread (&file_lock);
+    if (!has_lock)
+      lock_acquire (&file_lock);
+    file_backed_write (page, frame);
+    if (!has_lock)
+      lock_release (&file_lock);
+  }
 
-  return true;
+  vm_release_frame (page);
+  if (frame != NULL)
+    frame_unpin (frame);
 }
 
 /* Do the mmap */
 void *
 do_mmap (void *addr, size_t length, int writable, struct file *file,
          off_t offset) {
+  bool has_lock = lock_held_by_current_thread (&file_lock);
+  off_t file_len;
+  size_t read_bytes;
+
   ASSERT (pg_ofs (addr) == 0);
   ASSERT (offset % PGSIZE == 0);
 
-  size_t read_bytes = length;
-  size_t zero_bytes = ROUND_UP (length, PGSIZE) - length;
-  void *cur = addr;
-
-  struct supplemental_page_table *spt = &thread_current ()->spt;
-  for (size_t cur_ = 0; cur_ < length; cur_ += PGSIZE)
-    if (spt_find_page (spt, addr + cur_))
-      return NULL;
-
-  while (read_bytes > 0 || zero_bytes > 0) {
-    size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-    size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-    struct load_seg_args *aux = malloc (sizeof (struct load_seg_args));
-
-    if (aux == NULL)
-      return NULL;
-    // clang-format off
-    *aux = (struct load_seg_args){
-      .file = file,
-      .ofs = offset,
-      .page_read_bytes = page_read_bytes,
-      .page_zero_bytes = page_zero_bytes,
-      .read_bytes = read_bytes
-      };
-    // clang-format on
-
-    if (!vm_alloc_page_with_initializer (VM_FILE, cur, writable, mmap_lazy_load,
-                                         aux)) {
-      return NULL;
-    }
-
-    /* Advance. */
-    read_bytes -= page_read_bytes;
-    zero_bytes -= page_zero_bytes;
-    offset += PGSIZE;
-    cur += PGSIZE;
-  }
-
+  /* Only the bytes within the file are read and written back, the rest of
+   * the last page reads zeros. Writing back LENGTH bytes would grow the
+   * file. */
+  if (!has_lock)
+    lock_acquire (&file_lock);
+  file_len = file_length (file);
+  if (!has_lock)
+    lock_release (&file_lock);
+  read_bytes = file_len > offset ? (size_t) (file_len - offset) : 0;
+  if (read_bytes > length)
+    read_bytes = length;
+
+  if (vm_area_create (&thread_current ()->spt, addr, length, VM_FILE, writable,
+                      file, offset, read_bytes) == NULL)
+    return NULL;
   return addr;
 }
 
@@ -159,33 +139,8 @@ do_mmap (void *addr, size_t length, int writable, struct file *file,
 void
 do_munmap (void *addr) {
   struct supplemental_page_table *spt = &thread_current ()->spt;
-  struct page *page_p = spt_find_page (spt, addr);
-  void *cur = addr;
-  long remain_length;
-  size_t write_bytes;
-
-  remain_length = page_p->mmap_length;
-  while (remain_length > 0) {
-    write_bytes = remain_length > 0 && remain_length < PGSIZE   //
-                      ? remain_length
-                      : PGSIZE;
-
-    if (VM_TYPE (page_p->type) == VM_FILE) {
-      struct load_seg_args *args = (struct load_seg_args *) (page_p->file.aux);
-      struct file *file = args->file;
-      off_t ofs = args->ofs;
-
-      if (pml4_is_dirty (thread_current ()->pml4, cur))
-        file_write_at (file, cur, write_bytes, ofs);
-    }
-
-    cur += PGSIZE;
-    if (page_p->operations->type == VM_FILE)
-      list_remove (&page_p->mmap_elem);
-
-    spt_remove_page (spt, page_p);
-    page_p = spt_find_page (spt, cur);
-
-    remain_length -= PGSIZE;
-  }
+  struct vm_area *area = vm_area_find (spt, addr);
+
+  if (area != NULL && area->start == addr && VM_TYPE (area->type) == VM_FILE)
+    vm_area_destroy (spt, area);
 }
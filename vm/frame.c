@@ -0,0 +1,714 @@
+/* frame.c: Frame table.
+ *
+ * Every user frame handed out to the VM has a struct frame, found in O(1)
+ * from its kernel address. The frame keeps a reverse map of the pages
+ * mapping it, so that accessed and dirty state is read from its mappings
+ * only, and a pin count that keeps it from being evicted while the kernel
+ * works on it.
+ *
+ * Locking: frame_tbl.lock protects allocation, the free list and the
+ * replacement policy; the per-frame lock protects the reverse map and the
+ * pin count. frame_tbl.lock is taken first. Eviction only ever tries the
+ * lock of a frame, and passes over busy frames.
+ *
+ * Eviction drops frame_tbl.lock for its writes. Its victims stay locked and
+ * are marked as evicting meanwhile; frame_pin_page () waits for them. */
+
+#include "vm/frame.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/text.h"
+#include "vm/vm.h"
+
+struct frame_table {
+  struct lock lock;
+  struct list free_frames; /* Frames reclaimed ahead of demand. */
+  size_t free_cnt;         /* Length of FREE_FRAMES. */
+  size_t used_cnt;         /* Frames taken from the user pool. */
+  struct frame **arr;      /* Frame of each user pool page, or NULL. */
+  int ptr;                 /* Clock hand, an index into ARR. */
+
+  size_t evict_cnt;             /* Victims with an eviction in progress. */
+  struct condition evict_done; /* Signaled when an eviction ends. */
+
+  struct semaphore reclaim; /* Wakes up the reclaim daemon. */
+  bool reclaim_pending;     /* RECLAIM has been upped, not yet served. */
+};
+
+static struct frame_table frame_tbl;
+
+/* Free frames, counting both the free list and the user pool, below which
+ * the reclaim daemon is woken up and up to which it reclaims.
+ * Set with -vm-low and -vm-high, a low watermark of 0 disables the daemon. */
+size_t vm_low_watermark = 16;
+size_t vm_high_watermark = 32;
+
+static void frame_free (struct frame *frame);
+static void vm_reclaimd (void *aux UNUSED);
+
+/* Page replacement policy.
+ * The policy is told about every frame handed out by frame_alloc () and
+ * every frame given back to the user pool, and picks eviction victims. All
+ * hooks run with frame_tbl.lock held. */
+struct vm_policy {
+  const char *name;
+  void (*init) (void);
+  void (*insert) (struct frame *); /* FRAME was just handed out. */
+  void (*remove) (struct frame *); /* FRAME goes back to the user pool. */
+
+  /* Return a victim, inspecting at most *SCAN frames and decrementing *SCAN
+   * for each, or NULL. The victim is returned with its lock held and is no
+   * longer tracked by the policy. */
+  struct frame *(*victim) (size_t *scan);
+};
+
+static const struct vm_policy clock_policy;
+static const struct vm_policy lru_policy;
+static const struct vm_policy *vm_policy = &lru_policy;
+
+/* Cache of struct frame. A frame is destroyed unlocked and mapped by no
+ * page, which is the state its constructor leaves it in. */
+static struct kmem_cache *frame_cache;
+
+static void
+frame_ctor (void *frame_) {
+  struct frame *frame = frame_;
+
+  lock_init (&frame->lock);
+  list_init (&frame->pages);
+  frame->page = NULL;
+  frame->ref_cnt = 0;
+  frame->text = NULL;
+}
+
+void
+frame_table_init (void) {
+  frame_tbl.arr = calloc (get_pages_size (), sizeof *frame_tbl.arr);
+  if (frame_tbl.arr == NULL)
+    PANIC ("cannot allocate the frame table");
+  frame_cache = kmem_cache_create ("frame", sizeof (struct frame), frame_ctor);
+  if (frame_cache == NULL)
+    PANIC ("cannot allocate the frame table");
+  frame_tbl.ptr = 0;
+
+  lock_init (&frame_tbl.lock);
+  list_init (&frame_tbl.free_frames);
+  frame_tbl.free_cnt = 0;
+  frame_tbl.used_cnt = 0;
+  frame_tbl.evict_cnt = 0;
+  cond_init (&frame_tbl.evict_done);
+
+  /* Never let the daemon hold more than half of the user pool. */
+  if (vm_high_watermark > (size_t) get_pages_size () / 2)
+    vm_high_watermark = (size_t) get_pages_size () / 2;
+  if (vm_low_watermark > vm_high_watermark)
+    vm_low_watermark = vm_high_watermark;
+
+  vm_policy->init ();
+
+  sema_init (&frame_tbl.reclaim, 0);
+  frame_tbl.reclaim_pending = false;
+  if (vm_low_watermark > 0 &&
+      thread_create ("vm_reclaimd", PRI_DEFAULT, vm_reclaimd, NULL) ==
+          TID_ERROR)
+    PANIC ("cannot start page reclaim daemon");
+}
+
+/* Returns the frame at kernel address KVA, or NULL if KVA is not a frame
+ * in use by the VM. */
+struct frame *
+frame_lookup (const void *kva) {
+  int idx = (int) (pg_round_down (kva) - get_base ()) / PGSIZE;
+
+  if (idx < 0 || idx >= get_pages_size ())
+    return NULL;
+  return frame_tbl.arr[idx];
+}
+
+/* Attach PAGE to FRAME. The first page linked becomes the frame's owner.
+ * Caller holds FRAME's lock. */
+void
+frame_link (struct frame *frame, struct page *page) {
+  ASSERT (lock_held_by_current_thread (&frame->lock));
+
+  page->frame = frame;
+  list_push_back (&frame->pages, &page->frame_elem);
+  frame->ref_cnt++;
+
+  if (frame->page == NULL)
+    frame->page = page;
+}
+
+/* Detach PAGE from FRAME. If PAGE was the owner, ownership passes to the
+ * next sharer, if any. A write made through PAGE's mapping is remembered in
+ * the frame. Caller holds FRAME's lock. */
+void
+frame_unlink (struct frame *frame, struct page *page) {
+  ASSERT (lock_held_by_current_thread (&frame->lock));
+
+  if (pml4_is_dirty (page->pml4, page->va))
+    frame->dirty = true;
+
+  list_remove (&page->frame_elem);
+  frame->ref_cnt--;
+  page->frame = NULL;
+
+  if (frame->page == page)
+    frame->page = frame->ref_cnt > 0
+                      ? list_entry (list_front (&frame->pages), struct page,
+                                    frame_elem)
+                      : NULL;
+}
+
+/* Whether FRAME was written since its contents were loaded or last written
+ * back, through any of its mappings. Caller holds FRAME's lock. */
+bool
+frame_is_dirty (struct frame *frame) {
+  struct list_elem *e;
+
+  if (frame->dirty)
+    return true;
+  for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+       e = list_next (e)) {
+    struct page *page = list_entry (e, struct page, frame_elem);
+
+    if (pml4_is_dirty (page->pml4, page->va))
+      return true;
+  }
+  return false;
+}
+
+/* Whether FRAME was accessed through any of its mappings since the last
+ * call. Clears the accessed bits and records the result in FRAME's age.
+ * Caller holds FRAME's lock. */
+static bool
+frame_referenced (struct frame *frame) {
+  struct list_elem *e;
+  bool referenced = false;
+
+  for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+       e = list_next (e)) {
+    struct page *page = list_entry (e, struct page, frame_elem);
+
+    if (pml4_is_accessed (page->pml4, page->va)) {
+      pml4_set_accessed (page->pml4, page->va, false);
+      referenced = true;
+    }
+  }
+
+  frame->age = (frame->age >> 1) | (referenced ? 0x80 : 0);
+  return referenced;
+}
+
+/* Pin the frame of PAGE, if it is resident, so that it stays there until
+ * frame_unpin (). Returns the frame, or NULL if PAGE is not resident.
+ * Waits for an eviction of PAGE in progress to end. */
+struct frame *
+frame_pin_page (struct page *page) {
+  struct frame *frame;
+
+  /* PAGE->FRAME only changes under frame_tbl.lock. */
+  lock_acquire (&frame_tbl.lock);
+  while ((frame = page->frame) != NULL && frame->evicting)
+    cond_wait (&frame_tbl.evict_done, &frame_tbl.lock);
+  if (frame != NULL) {
+    lock_acquire (&frame->lock);
+    frame->pin_cnt++;
+    lock_release (&frame->lock);
+  }
+  lock_release (&frame_tbl.lock);
+
+  return frame;
+}
+
+/* Drop a pin on FRAME. A frame neither pinned nor mapped anymore goes back
+ * to the user pool. */
+void
+frame_unpin (struct frame *frame) {
+  bool unused;
+
+  lock_acquire (&frame->lock);
+  ASSERT (frame->pin_cnt > 0);
+  frame->pin_cnt--;
+  unused = frame->pin_cnt == 0 && frame->ref_cnt == 0;
+  lock_release (&frame->lock);
+
+  if (unused)
+    frame_free (frame);
+}
+
+/* Lock FRAME if it may be evicted: it is mapped by a single page, is not
+ * pinned and nobody else holds its lock. Frames shared copy-on-write are
+ * skipped, they are released by the write fault. */
+static bool
+frame_try_hold (struct frame *frame) {
+  if (frame == NULL || !lock_try_acquire (&frame->lock))
+    return false;
+  if (frame->page != NULL && frame->ref_cnt == 1 && frame->pin_cnt == 0)
+    return true;
+  lock_release (&frame->lock);
+  return false;
+}
+
+/* Give FRAME back to the user pool. Caller holds frame_tbl.lock. */
+static void
+frame_destroy (struct frame *frame) {
+  int idx = (int) (frame->kva - get_base ()) / PGSIZE;
+
+  ASSERT (frame->ref_cnt == 0);
+  ASSERT (frame->pin_cnt == 0);
+  ASSERT (0 <= idx && idx < get_pages_size ());
+
+  if (frame->text != NULL)
+    text_forget (frame);
+  vm_policy->remove (frame);
+  frame_tbl.arr[idx] = NULL;
+  frame_tbl.used_cnt--;
+  palloc_free_page (frame->kva);
+  kmem_cache_free (frame_cache, frame);
+}
+
+/* Give FRAME, which no page maps anymore, back to the user pool. */
+static void
+frame_free (struct frame *frame) {
+  lock_acquire (&frame_tbl.lock);
+  frame_destroy (frame);
+  lock_release (&frame_tbl.lock);
+}
+
+/* Number of frames that can be handed out without evicting.
+ * Caller holds frame_tbl.lock. */
+static size_t
+frame_available (void) {
+  return frame_tbl.free_cnt + (get_pages_size () - frame_tbl.used_cnt);
+}
+
+/* Whether CNT frames can be handed out without waking up the reclaim
+ * daemon. */
+bool
+frame_has_room (size_t cnt) {
+  bool room;
+
+  lock_acquire (&frame_tbl.lock);
+  room = frame_available () >= cnt + vm_low_watermark;
+  lock_release (&frame_tbl.lock);
+
+  return room;
+}
+
+/* Get the struct frame, that will be evicted, from the current policy.
+ * Returns NULL if no victim was found within *SCAN frames. */
+static struct frame *
+vm_get_victim (size_t *scan) {
+  size_t budget = *scan;
+  struct frame *victim = vm_policy->victim (scan);
+
+  vm_stats.scans += budget - *scan;
+  return victim;
+}
+
+/* Whether evicting PAGE needs no write. */
+static bool
+page_is_clean (struct page *page) {
+  if (page_get_type (page) == VM_ANON)
+    return anon_is_clean (page);
+  return !frame_is_dirty (page->frame);
+}
+
+/* Called by the policies on a cold FRAME. A dirty frame is passed over once,
+ * so that clean frames, which are evicted without I/O, go first. */
+static bool
+vm_victim_defer (struct frame *frame) {
+  if (!frame->deferred && !page_is_clean (frame->page)) {
+    frame->deferred = true;
+    return true;
+  }
+  frame->deferred = false;
+  return false;
+}
+
+/* Clock policy.
+ * A single hand sweeps frame_tbl.arr, clearing accessed bits and taking the
+ * first frame found not accessed since the last pass. */
+static void
+clock_init (void) {}
+
+static void
+clock_track (struct frame *frame UNUSED) {}
+
+static struct frame *
+clock_victim (size_t *scan) {
+  int pages_size = get_pages_size ();
+
+  while (*scan > 0) {
+    struct frame *cur = frame_tbl.arr[frame_tbl.ptr];
+
+    frame_tbl.ptr += 1;
+    frame_tbl.ptr %= pages_size;
+    *scan -= 1;
+
+    if (!frame_try_hold (cur))
+      continue;
+    if (!frame_referenced (cur) && !vm_victim_defer (cur))
+      return cur;
+    lock_release (&cur->lock);
+  }
+
+  return NULL;
+}
+
+static const struct vm_policy clock_policy = {
+    .name = "clock",
+    .init = clock_init,
+    .insert = clock_track,
+    .remove = clock_track,
+    .victim = clock_victim,
+};
+
+/* Two-list LRU policy.
+ * New frames start on the inactive list and are only promoted to the active
+ * list when referenced again while there, so that pages touched once (a
+ * sequential scan) are reclaimed before the working set. The active list is
+ * aged into the inactive one whenever it grows larger than it; a frame is
+ * demoted once it was not referenced in its last two scans. */
+static struct {
+  struct list active;
+  struct list inactive;
+  size_t active_cnt;
+  size_t inactive_cnt;
+} lru;
+
+static void
+lru_init (void) {
+  list_init (&lru.active);
+  list_init (&lru.inactive);
+  lru.active_cnt = 0;
+  lru.inactive_cnt = 0;
+}
+
+/* Append FRAME to LIST, which is one of the LRU lists. */
+static void
+lru_push (struct list *list, struct frame *frame) {
+  list_push_back (list, &frame->lru_elem);
+  frame->lru = list;
+  if (list == &lru.active)
+    lru.active_cnt++;
+  else
+    lru.inactive_cnt++;
+}
+
+/* Take the frame at the front of LIST, which must not be empty. */
+static struct frame *
+lru_pop (struct list *list) {
+  struct frame *frame =
+      list_entry (list_pop_front (list), struct frame, lru_elem);
+
+  frame->lru = NULL;
+  if (list == &lru.active)
+    lru.active_cnt--;
+  else
+    lru.inactive_cnt--;
+  return frame;
+}
+
+static void
+lru_insert (struct frame *frame) {
+  lru_push (&lru.inactive, frame);
+}
+
+static void
+lru_remove (struct frame *frame) {
+  if (frame->lru == NULL)
+    return;
+
+  list_remove (&frame->lru_elem);
+  if (frame->lru == &lru.active)
+    lru.active_cnt--;
+  else
+    lru.inactive_cnt--;
+  frame->lru = NULL;
+}
+
+static struct frame *
+lru_victim (size_t *scan) {
+  while (*scan > 0) {
+    struct frame *cur;
+
+    /* Age the head of the active list. */
+    if (lru.active_cnt > lru.inactive_cnt || list_empty (&lru.inactive)) {
+      if (list_empty (&lru.active))
+        break;
+
+      cur = lru_pop (&lru.active);
+      *scan -= 1;
+      if (frame_try_hold (cur)) {
+        frame_referenced (cur);
+        lru_push ((cur->age & 0xc0) ? &lru.active : &lru.inactive, cur);
+        lock_release (&cur->lock);
+      } else
+        lru_push (&lru.active, cur);
+      continue;
+    }
+
+    cur = lru_pop (&lru.inactive);
+    *scan -= 1;
+
+    if (!frame_try_hold (cur)) {
+      lru_push (&lru.inactive, cur);
+      continue;
+    }
+    if (frame_referenced (cur))
+      lru_push (&lru.active, cur);
+    else if (vm_victim_defer (cur))
+      lru_push (&lru.inactive, cur);
+    else
+      return cur;
+    lock_release (&cur->lock);
+  }
+
+  return NULL;
+}
+
+static const struct vm_policy lru_policy = {
+    .name = "lru",
+    .init = lru_init,
+    .insert = lru_insert,
+    .remove = lru_remove,
+    .victim = lru_victim,
+};
+
+/* Select the replacement policy called NAME. Must be called before
+ * vm_init (). Returns false if there is no such policy. */
+bool
+vm_set_policy (const char *name) {
+  static const struct vm_policy *policies[] = {&clock_policy, &lru_policy};
+
+  for (size_t i = 0; i < sizeof policies / sizeof *policies; i++)
+    if (!strcmp (policies[i]->name, name)) {
+      vm_policy = policies[i];
+      return true;
+    }
+  return false;
+}
+
+const char *
+frame_policy_name (void) {
+  return vm_policy->name;
+}
+
+/* Pick a cluster of up to SWAP_CLUSTER victims into VICTIMS and return how
+ * many were found. */
+static size_t
+vm_pick_victims (struct frame *victims[]) {
+  size_t victim_cnt = 0;
+  size_t pages_size = get_pages_size ();
+  size_t scan;
+
+  /* Several sweeps for the first victim: the first ones may only clear
+   * accessed bits, age frames between lists or pass over dirty frames. The
+   * rest of the cluster has to be found in the remainder of a single sweep,
+   * so that the clock never picks a frame twice. */
+  scan = pages_size * 6;
+  victims[victim_cnt] = vm_get_victim (&scan);
+  if (victims[victim_cnt] == NULL)
+    return 0;
+  victim_cnt++;
+
+  scan = pages_size - 1;
+  if (scan > SWAP_CLUSTER * 4)
+    scan = SWAP_CLUSTER * 4;
+  while (victim_cnt < SWAP_CLUSTER &&
+         (victims[victim_cnt] = vm_get_victim (&scan)) != NULL)
+    victim_cnt++;
+
+  return victim_cnt;
+}
+
+/* Evict a cluster of up to SWAP_CLUSTER cold pages and return the frame of
+ * one of them; the others go back to the user pool. Clean victims are
+ * dropped without I/O, dirty anonymous ones are swapped out together into
+ * consecutive slots with one sequential write. A victim that cannot be
+ * evicted stays mapped and goes back to the policy.
+ * Caller holds frame_tbl.lock. It is released while the victims are written
+ * out, and held again on return. Return NULL on error.*/
+static struct frame *
+vm_evict_frame (void) {
+  struct frame *victims[SWAP_CLUSTER];
+  struct page *anon_pages[SWAP_CLUSTER];
+  size_t anon_idx[SWAP_CLUSTER];
+  bool evicted[SWAP_CLUSTER];
+  struct frame *frame = NULL;
+
+  for (int try = 0; frame == NULL && try < 3; try++) {
+    size_t victim_cnt = vm_pick_victims (victims);
+    size_t anon_cnt = 0;
+
+    if (victim_cnt == 0)
+      return NULL;
+
+    for (size_t i = 0; i < victim_cnt; i++)
+      victims[i]->evicting = true;
+    frame_tbl.evict_cnt += victim_cnt;
+    lock_release (&frame_tbl.lock);
+
+    for (size_t i = 0; i < victim_cnt; i++) {
+      struct page *page = victims[i]->page;
+
+      if (page_get_type (page) == VM_ANON && !anon_is_clean (page)) {
+        anon_idx[anon_cnt] = i;
+        anon_pages[anon_cnt++] = page;
+        evicted[i] = true;
+      } else
+        evicted[i] = swap_out (page);
+    }
+
+    if (anon_cnt > 1 && anon_swap_out_cluster (anon_pages, anon_cnt))
+      anon_cnt = 0;
+    for (size_t i = 0; i < anon_cnt; i++)
+      evicted[anon_idx[i]] = swap_out (anon_pages[i]);
+
+    lock_acquire (&frame_tbl.lock);
+    for (size_t i = 0; i < victim_cnt; i++) {
+      struct frame *victim = victims[i];
+
+      victim->evicting = false;
+      if (!evicted[i]) {
+        lock_release (&victim->lock);
+        vm_policy->insert (victim);
+        continue;
+      }
+
+      vm_stats.evictions++;
+      frame_unlink (victim, victim->page);
+      lock_release (&victim->lock);
+      if (frame == NULL) {
+        if (victim->text != NULL)
+          text_forget (victim);
+        frame = victim;
+      } else
+        frame_destroy (victim);
+    }
+    frame_tbl.evict_cnt -= victim_cnt;
+    cond_broadcast (&frame_tbl.evict_done, &frame_tbl.lock);
+  }
+
+  return frame;
+}
+
+/* palloc() and get frame. If there is no available page, evict the page
+ * and return it. This always return valid address. That is, if the user pool
+ * memory is full, this function evicts the frame to get the available memory
+ * space.
+ * Frames reclaimed by the daemon are used first, so that a fault only pays
+ * for the eviction when the daemon could not keep up.
+ * The frame is returned pinned and mapped by no page; unpin it once it is
+ * linked and filled. */
+struct frame *
+frame_alloc (void) {
+  struct frame *frame = NULL;
+  void *kva = NULL;
+
+  lock_acquire (&frame_tbl.lock);
+  while (frame == NULL) {
+    if (!list_empty (&frame_tbl.free_frames)) {
+      frame = list_entry (list_pop_front (&frame_tbl.free_frames),
+                          struct frame, free_elem);
+      frame_tbl.free_cnt--;
+    } else if ((kva = palloc_get_page (PAL_USER)) != NULL) {
+      // !!! MALLOC !!!
+      frame = kmem_cache_alloc (frame_cache);
+      if (frame == NULL)
+        PANIC ("frame_alloc() out of kernel memory");
+      frame->kva = kva;
+
+      int idx = (int) (frame->kva - get_base ()) / PGSIZE;
+
+      ASSERT (0 <= idx && idx < get_pages_size ());
+      frame_tbl.arr[idx] = frame;
+      frame_tbl.used_cnt++;
+    } else if ((frame = vm_evict_frame ()) == NULL) {
+      /* Every evictable frame may be the victim of another eviction, which
+       * frees frames when it ends. */
+      if (frame_tbl.evict_cnt == 0)
+        PANIC ("frame_alloc() eviction failed");
+      cond_wait (&frame_tbl.evict_done, &frame_tbl.lock);
+    }
+  }
+
+  ASSERT (frame->page == NULL && frame->ref_cnt == 0 && frame->text == NULL);
+  frame->pin_cnt = 1;
+  frame->evicting = false;
+  frame->age = 0;
+  frame->dirty = false;
+  frame->lru = NULL;
+  frame->deferred = false;
+  vm_policy->insert (frame);
+
+  if (frame_available () < vm_low_watermark && !frame_tbl.reclaim_pending) {
+    frame_tbl.reclaim_pending = true;
+    sema_up (&frame_tbl.reclaim);
+  }
+  lock_release (&frame_tbl.lock);
+
+  return frame;
+}
+
+/* Page reclaim daemon.
+ * Sleeps until free frames drop below the low watermark, then evicts cold
+ * pages until the high watermark is reached. frame_tbl.lock is not held
+ * during the writes, and the daemon yields between clusters so that faulting
+ * threads are not held up behind a whole batch of them. */
+static void
+vm_reclaimd (void *aux UNUSED) {
+  for (;;) {
+    sema_down (&frame_tbl.reclaim);
+
+    lock_acquire (&frame_tbl.lock);
+    while (frame_available () < vm_high_watermark) {
+      struct frame *frame = vm_evict_frame ();
+
+      if (frame == NULL)
+        break;
+      list_push_back (&frame_tbl.free_frames, &frame->free_elem);
+      frame_tbl.free_cnt++;
+
+      lock_release (&frame_tbl.lock);
+      thread_yield ();
+      lock_acquire (&frame_tbl.lock);
+    }
+    frame_tbl.reclaim_pending = false;
+    lock_release (&frame_tbl.lock);
+  }
+}
+
+/* Unmap PAGE and drop its reference to the frame. The frame goes back to the
+ * user pool once its last sharer lets go of it. */
+void
+vm_release_frame (struct page *page) {
+  struct frame *frame;
+
+  /* The zero page is not ours to free. */
+  if (page->zero) {
+    pml4_clear_page (page->pml4, page->va);
+    page->zero = false;
+    return;
+  }
+
+  frame = frame_pin_page (page);
+  if (frame == NULL)
+    return;
+
+  lock_acquire (&frame->lock);
+  pml4_clear_page (page->pml4, page->va);
+  frame_unlink (frame, page);
+  lock_release (&frame->lock);
+
+  frame_unpin (frame);
+}
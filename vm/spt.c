@@ -0,0 +1,180 @@
+/* spt.c: Supplemental page table, a radix tree over user page numbers.
+ *
+ * Every level resolves SPT_BITS bits of the page number, the leaves of the
+ * last level are the pages themselves. Nodes are created on insertion and
+ * freed as soon as they become empty, so sparse address spaces (code at the
+ * bottom, stack at the top) only cost a few nodes. Walking the tree visits
+ * pages in address order. */
+
+#include "vm/vm.h"
+#include <string.h>
+#include "threads/slab.h"
+#include "threads/vaddr.h"
+
+#define SPT_BITS   6
+#define SPT_FANOUT (1 << SPT_BITS)
+#define SPT_LEVELS 5
+
+/* Page numbers the tree can hold, enough for all of user space. */
+#define SPT_PAGES ((uint64_t) 1 << (SPT_BITS * SPT_LEVELS))
+
+/* Interior node. The slots of the last level point to struct page. */
+struct spt_node {
+  void *slots[SPT_FANOUT];
+};
+
+/* Cache of nodes. Nodes are freed empty, so they are zeroed only once. */
+static struct kmem_cache *node_cache;
+
+static void
+node_ctor (void *node) {
+  memset (node, 0, sizeof (struct spt_node));
+}
+
+void
+spt_init (void) {
+  node_cache = kmem_cache_create ("spt_node", sizeof (struct spt_node),
+                                  node_ctor);
+  if (node_cache == NULL)
+    PANIC ("spt_init() out of memory");
+}
+
+/* Index into a node at LEVEL, 0 being the root, for page number PGNO. */
+static inline size_t
+slot_idx (uint64_t pgno, int level) {
+  return (pgno >> (SPT_BITS * (SPT_LEVELS - 1 - level))) & (SPT_FANOUT - 1);
+}
+
+static bool
+node_is_empty (struct spt_node *node) {
+  for (size_t i = 0; i < SPT_FANOUT; i++)
+    if (node->slots[i] != NULL)
+      return false;
+  return true;
+}
+
+/* Find VA from spt and return page. On error, return NULL. */
+struct page *
+spt_find_page (struct supplemental_page_table *spt, void *va) {
+  uint64_t pgno = pg_no (va);
+  struct spt_node *node = spt->root;
+
+  if (pgno >= SPT_PAGES)
+    return NULL;
+
+  for (int level = 0; node != NULL && level < SPT_LEVELS - 1; level++)
+    node = node->slots[slot_idx (pgno, level)];
+
+  return node != NULL ? node->slots[slot_idx (pgno, SPT_LEVELS - 1)] : NULL;
+}
+
+/* Insert PAGE into spt with validation. Fails if its address is taken or
+ * out of range, or if memory for the tree runs out. */
+bool
+spt_insert_page (struct supplemental_page_table *spt, struct page *page) {
+  uint64_t pgno = pg_no (page->va);
+  struct spt_node **slot = &spt->root;
+
+  if (pgno >= SPT_PAGES)
+    return false;
+
+  for (int level = 0; level < SPT_LEVELS; level++) {
+    if (*slot == NULL) {
+      // !!! MALLOC !!!
+      *slot = kmem_cache_alloc (node_cache);
+      if (*slot == NULL)
+        return false;
+    }
+    slot = (struct spt_node **) &(*slot)->slots[slot_idx (pgno, level)];
+  }
+
+  if (*slot != NULL)
+    return false;
+  *slot = (struct spt_node *) page;
+  return true;
+}
+
+/* Remove PAGE from spt and free it. Nodes left empty are freed on the way
+ * back up. */
+void
+spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
+  uint64_t pgno = pg_no (page->va);
+  struct spt_node *path[SPT_LEVELS];
+  struct spt_node *node = spt->root;
+  int level;
+
+  for (level = 0; level < SPT_LEVELS; level++) {
+    ASSERT (node != NULL);
+    path[level] = node;
+    node = node->slots[slot_idx (pgno, level)];
+  }
+  ASSERT ((struct page *) node == page);
+
+  for (level = SPT_LEVELS - 1; level >= 0; level--) {
+    path[level]->slots[slot_idx (pgno, level)] = NULL;
+    if (!node_is_empty (path[level]))
+      break;
+    kmem_cache_free (node_cache, path[level]);
+  }
+  if (level < 0)
+    spt->root = NULL;
+
+  vm_dealloc_page (page);
+}
+
+/* The first page of the subtree NODE at LEVEL, in address order, whose page
+ * number within the subtree is PGNO or above. */
+static struct page *
+subtree_next (struct spt_node *node, int level, uint64_t pgno) {
+  for (size_t i = slot_idx (pgno, level); i < SPT_FANOUT; i++) {
+    struct page *page;
+
+    if (node->slots[i] == NULL)
+      ; /* Nothing here. */
+    else if (level == SPT_LEVELS - 1)
+      return node->slots[i];
+    else if ((page = subtree_next (node->slots[i], level + 1, pgno)) != NULL)
+      return page;
+
+    /* Later subtrees are searched from their start. */
+    pgno = 0;
+  }
+  return NULL;
+}
+
+/* Return the page of spt with the lowest address at or above VA, or NULL.
+ * Stepping from one page to the next visits the address space in order,
+ * and whether [START, END) is free takes a single call. */
+struct page *
+spt_next_page (struct supplemental_page_table *spt, void *va) {
+  uint64_t pgno = pg_no (pg_round_up (va));
+
+  if (spt->root == NULL || pgno >= SPT_PAGES)
+    return NULL;
+  return subtree_next (spt->root, 0, pgno);
+}
+
+static void
+subtree_clear (struct spt_node *node, int level,
+               void (*destructor) (struct page *)) {
+  for (size_t i = 0; i < SPT_FANOUT; i++) {
+    if (node->slots[i] == NULL)
+      continue;
+    if (level == SPT_LEVELS - 1)
+      destructor (node->slots[i]);
+    else
+      subtree_clear (node->slots[i], level + 1, destructor);
+    node->slots[i] = NULL;
+  }
+  kmem_cache_free (node_cache, node);
+}
+
+/* Pass every page of spt to DESTRUCTOR, in address order, and free the
+ * tree. */
+void
+spt_clear (struct supplemental_page_table *spt,
+           void (*destructor) (struct page *)) {
+  if (spt->root != NULL)
+    subtree_clear (spt->root, 0, destructor);
+  spt->root = NULL;
+}
@@ -0,0 +1,131 @@
+/* swap.c: Asynchronous swap I/O.
+ *
+ * Anonymous pages move between memory and the swap disk through a queue of
+ * page-sized requests served by a dedicated worker thread. Each request is
+ * issued as one multi-sector ATA transfer instead of a command per sector,
+ * and the queue is served in slot order so the disk head sweeps instead of
+ * seeking back and forth. A thread that submits a request only waits on the
+ * completion of its own request. */
+
+#include "vm/swap.h"
+#include <debug.h>
+#include "devices/disk.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+#define SECTORS_PER_PAGE (PGSIZE / DISK_SECTOR_SIZE)
+
+struct swap_io_queue {
+  struct list requests;   /* Pending struct swap_io, in submission order. */
+  struct lock lock;       /* Protects REQUESTS. */
+  struct semaphore ready; /* Number of pending requests. */
+  size_t head;            /* Slot right after the last transfer. */
+};
+
+static struct disk *swap_disk;
+static struct swap_io_queue swap_queue;
+
+static void swap_io_worker (void *aux);
+
+/* Start the swap I/O worker for DISK. */
+void
+swap_io_init (struct disk *disk) {
+  swap_disk = disk;
+
+  list_init (&swap_queue.requests);
+  lock_init (&swap_queue.lock);
+  sema_init (&swap_queue.ready, 0);
+  swap_queue.head = 0;
+
+  if (thread_create ("swapiod", PRI_DEFAULT, swap_io_worker, NULL) ==
+      TID_ERROR)
+    PANIC ("cannot start swap I/O worker");
+}
+
+/* Queue IO. Returns immediately, use swap_io_wait () for the result. */
+void
+swap_io_submit (struct swap_io *io) {
+  ASSERT (io->cnt > 0);
+  ASSERT (io->cnt * SECTORS_PER_PAGE <= DISK_MAX_SECTORS);
+
+  sema_init (&io->done, 0);
+
+  lock_acquire (&swap_queue.lock);
+  list_push_back (&swap_queue.requests, &io->elem);
+  lock_release (&swap_queue.lock);
+
+  sema_up (&swap_queue.ready);
+}
+
+/* Block until IO has been served. */
+void
+swap_io_wait (struct swap_io *io) {
+  sema_down (&io->done);
+}
+
+/* Read swap SLOT into the page at KVA. */
+void
+swap_io_read (size_t slot, void *kva) {
+  struct swap_io io = {.write = false, .slot = slot, .cnt = 1, .buf = kva};
+
+  swap_io_submit (&io);
+  swap_io_wait (&io);
+}
+
+/* Write the page at KVA to swap SLOT. */
+void
+swap_io_write (size_t slot, const void *kva) {
+  struct swap_io io = {
+      .write = true, .slot = slot, .cnt = 1, .buf = (void *) kva};
+
+  swap_io_submit (&io);
+  swap_io_wait (&io);
+}
+
+/* Elevator: the pending request with the lowest slot at or after the head,
+ * or the lowest slot overall once the sweep reached the end.
+ * Caller holds swap_queue.lock. */
+static struct swap_io *
+swap_io_next (void) {
+  struct swap_io *ahead = NULL, *lowest = NULL;
+  struct list_elem *e;
+
+  for (e = list_begin (&swap_queue.requests);
+       e != list_end (&swap_queue.requests); e = list_next (e)) {
+    struct swap_io *io = list_entry (e, struct swap_io, elem);
+
+    if (lowest == NULL || io->slot < lowest->slot)
+      lowest = io;
+    if (io->slot >= swap_queue.head && (ahead == NULL || io->slot < ahead->slot))
+      ahead = io;
+  }
+
+  return ahead != NULL ? ahead : lowest;
+}
+
+/* Worker thread serving the swap I/O queue. */
+static void
+swap_io_worker (void *aux UNUSED) {
+  for (;;) {
+    struct swap_io *io;
+    disk_sector_t sector;
+    size_t sec_cnt;
+
+    sema_down (&swap_queue.ready);
+
+    lock_acquire (&swap_queue.lock);
+    io = swap_io_next ();
+    list_remove (&io->elem);
+    lock_release (&swap_queue.lock);
+
+    sector = io->slot * SECTORS_PER_PAGE;
+    sec_cnt = io->cnt * SECTORS_PER_PAGE;
+    if (io->write)
+      disk_write_multiple (swap_disk, sector, sec_cnt, io->buf);
+    else
+      disk_read_multiple (swap_disk, sector, sec_cnt, io->buf);
+
+    swap_queue.head = io->slot + io->cnt;
+    sema_up (&io->done);
+  }
+}
@@ -1,5 +1,10 @@
 vm_SRC = vm/vm.c          # Main api proxy
+vm_SRC += vm/frame.c      # Frame table
+vm_SRC += vm/spt.c        # Supplemental page table
+vm_SRC += vm/area.c       # Address space regions
 vm_SRC += vm/uninit.c     # Uninitialized page
 vm_SRC += vm/anon.c       # Anonymous page
 vm_SRC += vm/file.c       # File mapped page
 vm_SRC += vm/inspect.c    # Testing utility
+vm_SRC += vm/swap.c       # Swap I/O queue
+vm_SRC += vm/text.c       # Shared executable pages
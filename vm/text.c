@@ -0,0 +1,125 @@
+/* text.c: Sharing of read-only executable pages.
+ *
+ * Frames holding a read-only segment page of an executable are indexed by
+ * (inode, file offset, bytes read), so that every process running the same
+ * binary maps the frame already loaded instead of reading its own copy.
+ * A frame stays indexed as long as some page maps it. Its executable cannot
+ * be written meanwhile, the processes running it deny writes to it. */
+
+#include "vm/text.h"
+#include <debug.h>
+#include <hash.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "vm/vm.h"
+
+struct text_page {
+  struct hash_elem elem;
+  struct inode *inode; /* Executable. */
+  off_t ofs;           /* Offset of the page in the file. */
+  size_t read_bytes;   /* Bytes read from the file, the rest is zeroed. */
+  struct frame *frame; /* Frame holding the page. */
+};
+
+static struct hash text_pages;
+static struct lock text_lock; /* Protects TEXT_PAGES and frame->text. */
+
+static uint64_t
+text_hash (const struct hash_elem *e, void *aux UNUSED) {
+  const struct text_page *t = hash_entry (e, struct text_page, elem);
+
+  return hash_bytes (&t->inode, sizeof t->inode) ^ hash_int (t->ofs);
+}
+
+static bool
+text_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED) {
+  const struct text_page *a = hash_entry (a_, struct text_page, elem);
+  const struct text_page *b = hash_entry (b_, struct text_page, elem);
+
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  if (a->ofs != b->ofs)
+    return a->ofs < b->ofs;
+  return a->read_bytes < b->read_bytes;
+}
+
+void
+text_init (void) {
+  hash_init (&text_pages, text_hash, text_less, NULL);
+  lock_init (&text_lock);
+}
+
+/* Link PAGE to the frame already holding READ_BYTES of FILE at OFS, if
+ * any. Returns true on success; the caller then maps the frame. */
+bool
+text_share (struct page *page, struct file *file, off_t ofs,
+            size_t read_bytes) {
+  struct text_page key = {
+      .inode = file_get_inode (file), .ofs = ofs, .read_bytes = read_bytes};
+  struct hash_elem *e;
+  bool shared = false;
+
+  lock_acquire (&text_lock);
+  e = hash_find (&text_pages, &key.elem);
+  if (e != NULL) {
+    struct frame *frame = hash_entry (e, struct text_page, elem)->frame;
+
+    /* Eviction takes TEXT_LOCK while holding frame locks: never wait for a
+     * frame here. An evicted frame is only forgotten after it lost its last
+     * page, so REF_CNT tells whether its contents are still valid. */
+    if (lock_try_acquire (&frame->lock)) {
+      if (frame->ref_cnt > 0) {
+        frame_link (frame, page);
+        shared = true;
+      }
+      lock_release (&frame->lock);
+    }
+  }
+  lock_release (&text_lock);
+
+  return shared;
+}
+
+/* Index FRAME, which has just been filled with READ_BYTES of FILE at OFS.
+ * The caller keeps FRAME pinned. */
+void
+text_add (struct frame *frame, struct file *file, off_t ofs,
+          size_t read_bytes) {
+  // !!! MALLOC !!!
+  struct text_page *t = malloc (sizeof *t);
+
+  if (t == NULL)
+    return;
+  t->inode = file_get_inode (file);
+  t->ofs = ofs;
+  t->read_bytes = read_bytes;
+  t->frame = frame;
+
+  lock_acquire (&text_lock);
+  if (frame->text == NULL && hash_insert (&text_pages, &t->elem) == NULL) {
+    frame->text = t;
+    t = NULL;
+  }
+  lock_release (&text_lock);
+
+  /* Another process indexed the same page first. */
+  free (t);
+}
+
+/* Drop FRAME from the index, once no page maps it anymore. */
+void
+text_forget (struct frame *frame) {
+  struct text_page *t;
+
+  lock_acquire (&text_lock);
+  t = frame->text;
+  if (t != NULL) {
+    hash_delete (&text_pages, &t->elem);
+    frame->text = NULL;
+  }
+  lock_release (&text_lock);
+
+  free (t);
+}
@@ -64,12 +64,6 @@ uninit_initialize (struct page *page, void *kva) {
  * PAGE will be freed by the caller. */
 static void
 uninit_destroy (struct page *page) {
-  struct uninit_page *uninit = &page->uninit;
-  void *aux = uninit->aux;
-  struct frame *frame_p = page->frame;
-
-  if (frame_p != NULL)
-    free (frame_p);
-  if (aux != NULL)
-    free (aux);
+  /* AUX is the page's area, which outlives it. */
+  vm_release_frame (page);
 }
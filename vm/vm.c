@@ -1,29 +1,33 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
 #include "threads/malloc.h"
+#include "threads/slab.h"
 #include "threads/mmu.h"
+#include "intrinsic.h"
 #include "string.h"
+#include <stdio.h>
 #include "vm/vm.h"
 #include "vm/file.h"
 #include "vm/anon.h"
 #include "vm/inspect.h"
+#include "vm/text.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "userprog/process.h"
-
-unsigned page_hash (const struct hash_elem *p_, void *aux UNUSED);
-bool page_less (const struct hash_elem *a_, const struct hash_elem *b_,
-                void *aux UNUSED);
+#include "userprog/syscall.h"
 
 #define MAX_STACK_SIZE (1 << 20)
 
-struct frame_table {
-  struct lock lock;
-  struct list list;
-  uint64_t *arr;
-  int ptr;
-};
+/* Pages mapped by one fault on a sequential scan of a file or executable. */
+#define FAULT_AROUND_PAGES 8
+
+struct vm_stats vm_stats;
 
-struct frame_table frame_tbl;
+/* Shared by every untouched demand-zero page, always mapped read-only. */
+static void *zero_kva;
+
+/* Cache of struct page. */
+static struct kmem_cache *page_cache;
 
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
@@ -31,16 +35,17 @@ void
 vm_init (void) {
   vm_anon_init ();
   vm_file_init ();
-#ifdef EFILESYS /* For project 4 */
-  pagecache_init ();
-#endif
   register_inspect_intr ();
   /* DO NOT MODIFY UPPER LINES. */
   /* TODO: Your code goes here. */
-  frame_tbl.arr = calloc (get_pages_size (), sizeof (uint64_t));
-  frame_tbl.ptr = 0;
-
-  lock_init (&frame_tbl.lock);
+  frame_table_init ();
+  text_init ();
+  zero_kva = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+  page_cache = kmem_cache_create ("page", sizeof (struct page), NULL);
+  if (page_cache == NULL)
+    PANIC ("vm_init() out of memory");
+  spt_init ();
+  vm_area_init ();
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -58,9 +63,9 @@ page_get_type (struct page *page) {
 }
 
 /* Helpers */
-static struct frame *vm_get_victim (void);
 static bool vm_do_claim_page (struct page *page);
-static struct frame *vm_evict_frame (void);
+static bool vm_share_text (struct page *page);
+static bool page_is_demand_zero (struct page *page);
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
@@ -84,7 +89,7 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
     /* TODO: Insert the page into the spt. */
 
     // !!! MALLOC !!!
-    page_p = malloc (sizeof (struct page));
+    page_p = kmem_cache_alloc (page_cache);
     bool success = false;
 
     if (page_p == NULL)
@@ -116,156 +121,188 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
   }
 err:
   if (page_p != NULL)
-    free (page_p);
+    kmem_cache_free (page_cache, page_p);
   return false;
 }
 
-/* Find VA from spt and return page. On error, return NULL. */
-struct page *
-spt_find_page (struct supplemental_page_table *spt, void *va) {
-  struct page *page = NULL;
-  struct page mock_page;
-  mock_page.va = pg_round_down (va);
-  struct hash_elem *cur;
-
-  if (cur = hash_find (&spt->page_table, &mock_page.elem)) {
-    page = hash_entry (cur, struct page, elem);
-  }
-
-  return page;
-}
-
-/* Insert PAGE into spt with validation. */
-bool
-spt_insert_page (struct supplemental_page_table *spt, struct page *page) {
-  int succ = false;
-
-  // TODO: validation 추가하기
-
-  if (hash_insert (&spt->page_table, &page->elem) == NULL) {
-    succ = true;
-  }
-
-  return succ;
-}
-
+/* Prints VM statistics. */
 void
-spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
-  void *res;
-  res = hash_delete (&spt->page_table, &page->elem);
-  vm_dealloc_page (page);
+vm_print_stats (void) {
+  printf ("VM: %lld faults, %lld page-ins, %lld shared, %lld evictions, "
+          "%lld frames scanned (%s policy)\n",
+          vm_stats.faults, vm_stats.page_ins, vm_stats.shared,
+          vm_stats.evictions, vm_stats.scans, frame_policy_name ());
 }
 
-/* Get the struct frame, that will be evicted. */
-static struct frame *
-vm_get_victim (void) {
-  struct frame *victim = NULL;
-  /* TODO: The policy for eviction is up to you. */
-  int pages_size = get_pages_size ();
-  bool found = false;
-
-  for (int i = 0; i < pages_size; i++) {
-    victim = frame_tbl.arr[frame_tbl.ptr];
-
-    if (!pml4_is_accessed (victim->page->pml4, victim->page->va)) {
-      found = true;
-    } else {
-      pml4_set_accessed (victim->page->pml4, victim->page->va, false);
-    }
+/* Create the stack area down to ADDR and claim the page at ADDR. */
+bool
+vm_alloc_stack_page (void *addr) {
+  ASSERT (pg_ofs (addr) == 0);
 
-    if (found) {
-      frame_tbl.ptr += 1;
-      frame_tbl.ptr %= pages_size;
-      break;
-    }
+  if (vm_area_create (&thread_current ()->spt, addr,
+                      USER_STACK - (uint64_t) addr,
+                      VM_ANON | VM_MARKER_0, true, NULL, 0, 0) == NULL)
+    return false;
 
-    frame_tbl.ptr += 1;
-    frame_tbl.ptr %= pages_size;
-  }
+  if (!vm_claim_page (addr))
+    return false;
 
-  return victim;
+  return true;
 }
 
-/* Evict one page and return the corresponding frame.
- * Return NULL on error.*/
-static struct frame *
-vm_evict_frame (void) {
-  bool success;
-  struct frame *victim = vm_get_victim ();
-  success = swap_out (victim->page);
-  /* TODO: swap out the victim and return the evicted frame. */
+/* Growing the stack, by extending the stack area down to ADDR. The new
+ * pages are demand-zero, they get a frame once they are touched. Nothing
+ * happens if another area lies in between. */
+static void
+vm_stack_growth (void *addr) {
+  struct supplemental_page_table *spt = &thread_current ()->spt;
+  struct vm_area *stack = vm_area_next (spt, addr);
 
-  return victim;
+  if (stack != NULL && (stack->type & VM_MARKER_0) && addr < stack->start)
+    stack->start = pg_round_down (addr);
 }
 
-/* palloc() and get frame. If there is no available page, evict the page
- * and return it. This always return valid address. That is, if the user pool
- * memory is full, this function evicts the frame to get the available memory
- * space.
- * frame은 null pointer가 아닌 것이 보장된다.
- * */
-static struct frame *
-vm_get_frame (void) {
-  struct frame *frame = NULL;
-  void *kva = NULL;
-
-  kva = palloc_get_page (PAL_USER);
-  if (kva == NULL) {
-    frame = vm_evict_frame ();
-  } else {
-    // !!! MALLOC !!!
-    frame = malloc (sizeof (struct frame));
-    if (frame == NULL)
-      PANIC ("vm_get_frame() todo 2");
-    /* insert frame table */
-    frame->kva = kva;
-    void *BASE = get_base ();
+/* Handle the fault on write_protected page.
+ * PAGE is writable but shares its frame copy-on-write. The last sharer just
+ * gets its write permission back, the others get a private copy. */
+static bool
+vm_handle_wp (struct page *page) {
+  struct frame *old_frame, *new_frame = NULL;
 
-    int idx = (int) (frame->kva - BASE) / PGSIZE;
+  if (!page->writable)
+    return false;
 
-    ASSERT (0 <= idx && idx < get_pages_size ());
-    frame_tbl.arr[idx] = frame;
-  }
+  /* First write to a demand-zero page: it gets a frame of its own. */
+  if (page->zero)
+    return vm_do_claim_page (page);
 
-  frame->page = NULL;
+  /* If the page got evicted meanwhile, retrying the access faults it back
+   * in. */
+  old_frame = frame_pin_page (page);
+  if (old_frame == NULL)
+    return true;
 
-  ASSERT (frame != NULL);
-  ASSERT (frame->page == NULL);
-  return frame;
-}
+  if (old_frame->ref_cnt > 1) {
+    new_frame = frame_alloc ();
 
-bool
-vm_alloc_stack_page (void *addr) {
-  ASSERT (pg_ofs (addr) == 0);
+    lock_acquire (&old_frame->lock);
+    if (old_frame->ref_cnt > 1) {
+      memcpy (new_frame->kva, old_frame->kva, PGSIZE);
+      frame_unlink (old_frame, page);
+      lock_release (&old_frame->lock);
 
-  if (!vm_alloc_page (VM_ANON | VM_MARKER_0, addr, true))
-    return false;
+      lock_acquire (&new_frame->lock);
+      frame_link (new_frame, page);
+      lock_release (&new_frame->lock);
+    } else
+      lock_release (&old_frame->lock);
+  }
 
-  if (!vm_claim_page (addr))
+  pml4_clear_page (page->pml4, page->va);
+  if (!pml4_set_page (page->pml4, page->va, page->frame->kva, true))
     return false;
+  pml4_set_dirty (page->pml4, page->va, true);
 
+  /* An unused NEW_FRAME goes back to the pool here. */
+  if (new_frame != NULL)
+    frame_unpin (new_frame);
+  frame_unpin (old_frame);
   return true;
 }
 
-/* Growing the stack. */
-static void
-vm_stack_growth (void *addr) {
-  bool success;
-  struct supplemental_page_table *spt = &thread_current ()->spt;
-  void *cur = pg_round_down (addr);
+/* Load PAGE, a page backed by a file or an executable. If the faults in
+ * SPT look sequential, the following pages of the region are loaded too,
+ * with a single read, so that the scan does not fault on each of them. */
+static bool
+vm_fault_around (struct supplemental_page_table *spt, struct page *page) {
+  struct page *pages[FAULT_AROUND_PAGES];
+  size_t cnt = 1, read_bytes;
+  struct vm_area *area = page->uninit.aux;
+  bool sequential = page->va == spt->next_fault;
+  bool has_lock, success;
+  void *buf = NULL;
+
+  /* Nothing to read if another process has the page loaded already. */
+  if (vm_share_text (page)) {
+    spt->next_fault = page->va + PGSIZE;
+    return true;
+  }
 
-  while (!spt_find_page (spt, cur)) {
-    success = vm_alloc_stack_page (cur);
-    if (!success)
-      PANIC ("stack allocation fail!");
+  pages[0] = page;
+  read_bytes = vm_area_page_read_bytes (area, page->va);
+  /* Don't read ahead into memory we would have to evict for it. */
+  if (sequential && !frame_has_room (FAULT_AROUND_PAGES))
+    sequential = false;
+
+  /* Only pages of the same area, still to be read, and as long as the
+   * file has data for them. */
+  while (sequential && cnt < FAULT_AROUND_PAGES && read_bytes == cnt * PGSIZE) {
+    void *va = page->va + cnt * PGSIZE;
+    size_t next_bytes;
+    struct page *next;
+
+    if (va >= area->end ||
+        (next_bytes = vm_area_page_read_bytes (area, va)) == 0)
+      break;
+    next = vm_area_page (spt, va);
+    if (next == NULL || VM_TYPE (next->operations->type) != VM_UNINIT)
+      break;
+    pages[cnt++] = next;
+    read_bytes += next_bytes;
+  }
 
-    cur += PGSIZE;
+  if (cnt > 1)
+    buf = palloc_get_multiple (0, cnt);
+  if (buf != NULL) {
+    has_lock = lock_held_by_current_thread (&file_lock);
+    if (!has_lock)
+      lock_acquire (&file_lock);
+    if (file_read_at (area->file, buf, read_bytes,
+                      vm_area_page_ofs (area, page->va)) != (off_t) read_bytes) {
+      palloc_free_multiple (buf, cnt);
+      buf = NULL;
+    }
+    if (!has_lock)
+      lock_release (&file_lock);
   }
+  if (buf == NULL)
+    cnt = 1;
+
+  spt->next_fault = page->va + cnt * PGSIZE;
+  area->prefetch = buf;
+  area->prefetch_va = page->va;
+  area->prefetch_cnt = cnt;
+  success = true;
+  /* Only the faulting page has to succeed. */
+  for (size_t i = 0; i < cnt; i++)
+    if (!vm_do_claim_page (pages[i]) && i == 0)
+      success = false;
+  area->prefetch = NULL;
+
+  if (buf != NULL)
+    palloc_free_multiple (buf, cnt);
+  return success;
+}
+
+/* Whether PAGE is anonymous memory that has never been touched and reads as
+ * zeros: a stack page, or a page of an executable's BSS. */
+static bool
+page_is_demand_zero (struct page *page) {
+  if (VM_TYPE (page->operations->type) != VM_UNINIT ||
+      VM_TYPE (page->uninit.type) != VM_ANON)
+    return false;
+  return vm_area_page_read_bytes (page->uninit.aux, page->va) == 0;
 }
 
-/* Handle the fault on write_protected page */
+/* Map PAGE, a demand-zero page, to the shared zero page. Writing it faults
+ * and gets the page a frame of its own. */
 static bool
-vm_handle_wp (struct page *page UNUSED) {}
+vm_map_zero (struct page *page) {
+  if (!pml4_set_page (page->pml4, page->va, zero_kva, false))
+    return false;
+  page->zero = true;
+  return true;
+}
 
 /* Return true on success */
 bool
@@ -274,36 +311,56 @@ vm_try_handle_fault (struct intr_frame *f, void *addr, bool user UNUSED,
   struct supplemental_page_table *spt = &thread_current ()->spt;
   struct page *page = spt_find_page (spt, addr);
 
+  vm_stats.faults++;
   if (!not_present && write)
-    return false;
+    return page != NULL ? vm_handle_wp (page) : false;
 
   // clang-format off
-  if (spt_find_page (spt, f->rsp) == NULL 
-   && addr < USER_STACK && addr >= USER_STACK - MAX_STACK_SIZE) {
+  if (vm_area_find (spt, addr) == NULL
+   && vm_area_find (spt, (void *) f->rsp) == NULL
+   && addr < (void *) USER_STACK
+   && addr >= (void *) USER_STACK - MAX_STACK_SIZE)
     vm_stack_growth (addr);
-    return true;
-  }
   // clang-format on
 
+  /* Pages are created on their first fault. */
+  if (page == NULL)
+    page = vm_area_page (spt, addr);
+
   if (page == NULL)
     return false;
 
+  /* PAGE is being evicted and was unmapped already. Once that is over, it
+   * is either swapped out or mapped again. */
+  if (page->frame != NULL) {
+    struct frame *frame = frame_pin_page (page);
+
+    if (frame != NULL) {
+      frame_unpin (frame);
+      return true;
+    }
+  }
+
+  /* Reading zeros needs no frame. */
+  if (page_is_demand_zero (page))
+    return write ? vm_do_claim_page (page) : vm_map_zero (page);
+  if (VM_TYPE (page->operations->type) == VM_UNINIT && page->uninit.init)
+    return vm_fault_around (spt, page);
   return vm_do_claim_page (page);
 }
 
-/* Free the page.
- * DO NOT MODIFY THIS FUNCTION. */
+/* Free the page. */
 void
 vm_dealloc_page (struct page *page) {
   destroy (page);
-  free (page);
+  kmem_cache_free (page_cache, page);
 }
 
 /* Claim the page that allocate on VA. */
 /* Eager Loading 기능 */
 bool
 vm_claim_page (void *va) {
-  struct page *page_p = spt_find_page (&thread_current ()->spt, va);
+  struct page *page_p = vm_area_page (&thread_current ()->spt, va);
 
   if (page_p == NULL)
     return false;
@@ -311,25 +368,80 @@ vm_claim_page (void *va) {
   return vm_do_claim_page (page_p);
 }
 
+/* The area of PAGE if it is a read-only executable page that has never been
+ * loaded, NULL otherwise. */
+static struct vm_area *
+page_text_area (struct page *page) {
+  if (VM_TYPE (page->operations->type) != VM_UNINIT || page->writable ||
+      VM_TYPE (page->uninit.type) != VM_ANON || page->uninit.init == NULL)
+    return NULL;
+  return page->uninit.aux;
+}
+
+/* Map PAGE, a read-only executable page, to the frame of another process
+ * running the same executable, if there is one. */
+static bool
+vm_share_text (struct page *page) {
+  struct vm_area *area = page_text_area (page);
+  struct uninit_page *uninit = &page->uninit;
+
+  if (area == NULL ||
+      !text_share (page, area->file, vm_area_page_ofs (area, page->va),
+                   vm_area_page_read_bytes (area, page->va)))
+    return false;
+
+  if (!pml4_set_page (page->pml4, page->va, page->frame->kva, false))
+    PANIC ("vm_share_text() out of memory");
+
+  /* The contents are there already, only turn PAGE into an anon page. */
+  vm_stats.shared++;
+  return uninit->page_initializer (page, uninit->type, page->frame->kva);
+}
+
 /* Claim the PAGE and set up the mmu. */
 static bool
 vm_do_claim_page (struct page *page) {
-  struct frame *frame = vm_get_frame ();
-  struct thread *t = thread_current ();
+  struct vm_area *text = page_text_area (page);
+  bool zero = page_is_demand_zero (page);
+  struct frame *frame;
   bool success = false;
 
+  if (!zero && vm_share_text (page))
+    return true;
+
+  frame = frame_alloc ();
+  if (zero)
+    zero_page (frame->kva);
+
   /* Set links */
-  frame->page = page;
-  page->frame = frame;
+  lock_acquire (&frame->lock);
+  frame_link (frame, page);
+  lock_release (&frame->lock);
+  vm_stats.page_ins++;
   /* TODO: Insert page table entry to map page's VA to frame's PA. */
   // printf ("%lx\n", page->va);
-  success = pml4_set_page (t->pml4, page->va, frame->kva, page->writable);
+  if (page->zero) {
+    pml4_clear_page (page->pml4, page->va);
+    page->zero = false;
+  }
+  success = pml4_set_page (page->pml4, page->va, frame->kva, page->writable);
 
   if (!success) {
     PANIC ("vm_do_claim_page() todo");
   }
 
-  return swap_in (page, frame->kva);
+  /* Stays pinned until filled, so that eviction cannot pick it meanwhile.
+   * A demand-zero page is filled already, it only becomes anonymous. */
+  if (zero)
+    success = page->uninit.page_initializer (page, page->uninit.type,
+                                             frame->kva);
+  else
+    success = swap_in (page, frame->kva);
+  if (success && text != NULL)
+    text_add (frame, text->file, vm_area_page_ofs (text, page->va),
+              vm_area_page_read_bytes (text, page->va));
+  frame_unpin (frame);
+  return success;
 }
 
 /* Initialize new supplemental page table */
@@ -337,69 +449,101 @@ void
 supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
   /* Project 3 - Virtual Memory */
   struct thread *t = thread_current ();
-  hash_init (&t->spt.page_table, page_hash, page_less, NULL);
-  list_init (&t->spt.mapped_pages);
+  t->spt.root = NULL;
+  list_init (&t->spt.areas);
+  t->spt.next_fault = NULL;
 }
 
-/* Copy supplemental page table from src to dst */
+/* Share the frame of resident PARENT_PAGE with a new page in the current
+ * thread's address space. Both mappings become read-only, the first write on
+ * either side takes a private copy in vm_handle_wp ().
+ * The caller keeps the frame pinned. */
+static bool
+spt_share_page (struct supplemental_page_table *dst,
+                struct page *parent_page, void *aux) {
+  struct page *page_p;
+  struct frame *frame = parent_page->frame;
+  bool dirty = pml4_is_dirty (parent_page->pml4, parent_page->va);
+
+  // !!! MALLOC !!!
+  page_p = kmem_cache_alloc (page_cache);
+  if (page_p == NULL)
+    return false;
+
+  memcpy (page_p, parent_page, sizeof (struct page));
+  page_p->pml4 = thread_current ()->pml4;
+  page_p->frame = NULL;
+
+  switch (VM_TYPE (page_p->operations->type)) {
+  case VM_ANON:
+    page_p->anon.aux = aux;
+    /* The parent keeps its swap copy, and INIT would read the parent's
+     * executable: the child's first eviction writes the page out. */
+    page_p->anon.swap_slot = SWAP_SLOT_NONE;
+    page_p->anon.clean_init = false;
+    break;
+  case VM_FILE:
+    page_p->file.aux = aux;
+    break;
+  default:
+    PANIC ("unexpected page type!");
+  }
+
+  if (!spt_insert_page (dst, page_p)) {
+    kmem_cache_free (page_cache, page_p);
+    return false;
+  }
+
+  lock_acquire (&frame->lock);
+  frame_link (frame, page_p);
+  lock_release (&frame->lock);
+
+  if (!pml4_set_page (parent_page->pml4, parent_page->va, frame->kva, false)
+      || !pml4_set_page (page_p->pml4, page_p->va, frame->kva, false))
+    return false;
+
+  /* Rewriting the PTEs cleared D; munmap still has to see the old writes. */
+  if (dirty) {
+    pml4_set_dirty (parent_page->pml4, parent_page->va, true);
+    pml4_set_dirty (page_p->pml4, page_p->va, true);
+  }
+
+  return true;
+}
+
+/* Copy supplemental page table from src to dst.
+ * The areas are copied, and resident pages are shared copy-on-write instead
+ * of copied, so fork only costs a PTE per page; frames are duplicated lazily
+ * on the first write. Pages never loaded are left for the child to create. */
 bool
 supplemental_page_table_copy (struct supplemental_page_table *dst,
                               struct supplemental_page_table *src) {
-  struct hash_iterator iter;
   struct page *parrent_page_p;
   bool success = false;
 
-  hash_first (&iter, src);
-
-  while (hash_next (&iter)) {
-    parrent_page_p = hash_entry (hash_cur (&iter), struct page, elem);
+  if (!vm_area_copy (dst, src))
+    goto err;
 
-    enum vm_type p_type = VM_TYPE (parrent_page_p->operations->type);
-    void *va = parrent_page_p->va;
-    void *p_aux = NULL;
-    bool writable = parrent_page_p->writable;
-    vm_initializer *init = NULL;
+  for (parrent_page_p = spt_next_page (src, NULL); parrent_page_p != NULL;
+       parrent_page_p = spt_next_page (src, parrent_page_p->va + PGSIZE)) {
+    if (VM_TYPE (parrent_page_p->operations->type) == VM_UNINIT)
+      continue;
 
-    void *aux = NULL;
-    int TMP_SIZE = sizeof (struct load_seg_args);
-    // todo: struct load_seg_args 이외 경우 대비하기
-
-    switch (p_type) {
-    case VM_UNINIT:
-      init = parrent_page_p->uninit.init;
-      p_aux = parrent_page_p->uninit.aux;
-      break;
-    case VM_ANON:
-      init = parrent_page_p->anon.init;
-      p_aux = parrent_page_p->anon.aux;
-      break;
-    case VM_FILE:
-      init = parrent_page_p->file.init;
-      p_aux = parrent_page_p->file.aux;
-      break;
+    /* Swapped out pages are brought back so that both sides can share. The
+     * frame is pinned, the parent's pages are still subject to eviction. */
+    struct frame *frame = frame_pin_page (parrent_page_p);
 
-    default:
-      PANIC ("unexpected page type!");
-      goto err;
+    while (frame == NULL) {
+      if (!vm_do_claim_page (parrent_page_p))
+        goto err;
+      frame = frame_pin_page (parrent_page_p);
     }
 
-    if (p_aux != NULL) {
-      aux = malloc (TMP_SIZE);
-      memcpy (aux, p_aux, TMP_SIZE);
-    }
-    // todo: stack 마킹은?
-    success = vm_alloc_page_with_initializer (page_get_type (parrent_page_p),
-                                              va, writable, init, aux);
+    success = spt_share_page (dst, parrent_page_p,
+                              vm_area_find (dst, parrent_page_p->va));
+    frame_unpin (frame);
     if (!success)
       goto err;
-
-    if (p_type != VM_UNINIT) {
-      success = vm_claim_page (va);
-      if (!success)
-        goto err;
-
-      memcpy (va, parrent_page_p->frame->kva, PGSIZE);
-    }
   }
 
   return true;
@@ -407,39 +551,13 @@ err:
   return false;
 }
 
-static void
-clear_page_resource (struct hash_elem *e, void *aux) {
-  struct page *page_p = hash_entry (e, struct page, elem);
-
-  vm_dealloc_page (page_p);
-}
-
-/* Free the resource hold by the supplemental page table */
+/* Free the resource hold by the supplemental page table.
+ * Destroying the areas writes back file mappings and removes their pages. */
 void
 supplemental_page_table_kill (struct supplemental_page_table *spt) {
-  struct list *mapped_pages = &thread_current ()->spt.mapped_pages;
+  while (!list_empty (&spt->areas))
+    vm_area_destroy (spt, list_entry (list_front (&spt->areas),
+                                      struct vm_area, elem));
 
-  if (list_begin (mapped_pages) != NULL)
-    while (!list_empty (mapped_pages)) {
-      struct list_elem *cur = list_begin (mapped_pages);
-      struct page *page_p = list_entry (cur, struct page, mmap_elem);
-      do_munmap (page_p->va);
-    }
-
-  hash_clear (&spt->page_table, clear_page_resource);
-}
-
-unsigned
-page_hash (const struct hash_elem *p_, void *aux UNUSED) {
-  const struct page *p = hash_entry (p_, struct page, elem);
-  return hash_bytes (&p->va, sizeof p->va);
+  spt_clear (spt, vm_dealloc_page);
 }
-
-bool
-page_less (const struct hash_elem *a_, const struct hash_elem *b_,
-           void *aux UNUSED) {
-  const struct page *a = hash_entry (a_, struct page, elem);
-  const struct page *b = hash_entry (b_, struct page, elem);
-
-  return a->va < b->va;
-}
\ No newline at end of file